@@ -0,0 +1,11 @@
+QT += core gui widgets network testlib
+
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+TARGET = mapbenchmark
+
+SOURCES += \
+    main.cpp
+
+include(../src/MapView.pri);
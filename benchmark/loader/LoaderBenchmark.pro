@@ -0,0 +1,15 @@
+QT += core gui widgets network
+
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+TARGET = maploaderbench
+
+SOURCES += \
+    main.cpp \
+    tileserver.cpp
+
+HEADERS += \
+    tileserver.h
+
+include(../../src/MapView.pri);
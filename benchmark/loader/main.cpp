@@ -0,0 +1,197 @@
+#include "tileserver.h"
+#include "mapview.h"
+#include "mapglobal.h"
+
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QApplication>
+#include <QPixmapCache>
+#include <QTextStream>
+#include <QThread>
+
+static const char *ProviderLocal = "LocalTiles";
+
+struct Step
+{
+    QString name;
+    int zoom;
+    QPointF shift; // viewports
+};
+
+// pans at one zoom, then zooms in and out around the last center
+static QVector<Step> script()
+{
+    QVector<Step> steps;
+    steps.append({"open", 12, QPointF()});
+
+    for (int i=0; i<4; ++i)
+        steps.append({QString("pan east %1").arg(i + 1), 12, QPointF(0.5, 0.)});
+
+    for (int i=0; i<2; ++i)
+        steps.append({QString("pan south %1").arg(i + 1), 12, QPointF(0., 0.5)});
+
+    for (int zoom=13; zoom<=15; ++zoom)
+        steps.append({QString("zoom in %1").arg(zoom), zoom, QPointF()});
+
+    for (int zoom=14; zoom>=11; --zoom)
+        steps.append({QString("zoom out %1").arg(zoom), zoom, QPointF()});
+
+    return steps;
+}
+
+static bool parseSize(const QString &text, QSize &size)
+{
+    const QStringList parts = text.split('x');
+    if (parts.size() != 2) return false;
+
+    size = QSize(parts.at(0).toInt(), parts.at(1).toInt());
+    return !size.isEmpty();
+}
+
+// waits until every tile of the viewport is loaded or failed
+static bool waitForTiles(MapView &view, int timeout)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    while (view.loaderStats().pending > 0)
+    {
+        if (timer.elapsed() > timeout) return false;
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 5);
+    }
+
+    return true;
+}
+
+static void runScript(MapView &view, const QString &pass, const QPointF &center, int timeout, QTextStream &out)
+{
+    MapGlobal &settings = MapGlobal::instance();
+    QPointF coords = center;
+
+    for (const Step &step: script())
+    {
+        view.resetLoaderStats();
+
+        QElapsedTimer timer;
+        timer.start();
+
+        // the loader requests the viewport tiles synchronously on these calls
+        if (step.zoom != view.zoom())
+            view.setZoom(step.zoom);
+
+        const QPointF shift(step.shift.x() * view.width() * settings.factor(),
+                            step.shift.y() * view.height() * settings.factor());
+        coords = settings.toCoords(settings.toPoint(coords) + shift);
+        view.setCenterOn(coords);
+
+        const bool isComplete = waitForTiles(view, timeout);
+        const qint64 elapsed = timer.elapsed();
+        const MapLoaderStats stats = view.loaderStats();
+
+        out << pass << ',' << step.name << ',' << step.zoom << ',' << elapsed << ','
+            << stats.requested << ',' << stats.memoryHits << ',' << stats.diskHits << ','
+            << stats.fetched << ',' << stats.failed << ',' << stats.aborted << ','
+            << stats.bytesFetched << ',' << (isComplete ? "complete" : "timeout") << endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    QCoreApplication::setApplicationName("maploaderbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Drives MapLoader through scripted pans and zooms against a local tile server "
+                                     "and prints the time to a full viewport and the bytes fetched per step as CSV.");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"port", "Server port, 0 picks a free one.", "port", "0"},
+        {"latency", "Delay of each response.", "msec", "20"},
+        {"bandwidth", "Bytes per second per connection, 0 is unlimited.", "bytes", "0"},
+        {"error-rate", "Part of the requests failed with 503.", "rate", "0"},
+        {"seed", "Seed of the failures.", "seed", "1"},
+        {"tiles", "Directory with z/x/y.png files, tiles are generated without it.", "path"},
+        {"size", "Viewport size.", "WxH", "1920x1080"},
+        {"timeout", "Longest wait for one step.", "msec", "30000"},
+        {"serve", "Only run the tile server."}
+    });
+    parser.process(app);
+
+    QSize size;
+    if (!parseSize(parser.value("size"), size))
+    {
+        qCritical("Invalid --size");
+        return 1;
+    }
+
+    qRegisterMetaType<TileServerStats>();
+
+    // the server has its own thread, serving does not delay the loader
+    QThread serverThread;
+    TileServer *server = new TileServer;
+    server->setLatency(parser.value("latency").toInt());
+    server->setBandwidth(parser.value("bandwidth").toInt());
+    server->setErrorRate(parser.value("error-rate").toDouble());
+    server->setSeed(parser.value("seed").toUInt());
+    server->setTilesPath(parser.value("tiles"));
+    server->moveToThread(&serverThread);
+    QObject::connect(&serverThread, &QThread::finished, server, &QObject::deleteLater);
+    serverThread.start();
+
+    quint16 port = 0;
+    QMetaObject::invokeMethod(server, "start", Qt::BlockingQueuedConnection, Q_RETURN_ARG(quint16, port),
+                              Q_ARG(quint16, static_cast<quint16>(parser.value("port").toUInt())));
+
+    if (port == 0)
+    {
+        qCritical("Can't listen on port %s", qPrintable(parser.value("port")));
+        serverThread.quit();
+        serverThread.wait();
+        return 1;
+    }
+
+    QTextStream out(stdout);
+
+    if (parser.isSet("serve"))
+    {
+        out << "Serving tiles on http://127.0.0.1:" << port << "/{z}/{x}/{y}.png" << endl;
+        const int result = app.exec();
+        serverThread.quit();
+        serverThread.wait();
+        return result;
+    }
+
+    QTemporaryDir cacheDir;
+    const QPointF center(-21.94, 64.15);
+    const int timeout = parser.value("timeout").toInt();
+
+    MapView view;
+    view.addProvider(ProviderLocal, {QString("http://127.0.0.1:%1/{z}/{x}/{y}.png").arg(port), "/local", Spherical});
+    view.setCachePath(cacheDir.path());
+    view.resize(size);
+    view.show();
+    view.setProvider(ProviderLocal);
+
+    QPixmapCache::clear();
+    out << "pass,step,zoom,msec,requested,memory_hits,disk_hits,fetched,failed,aborted,bytes,result" << endl;
+
+    // cold: empty caches, warm: the same script again over the filled caches
+    runScript(view, "cold", center, timeout, out);
+    runScript(view, "warm", center, timeout, out);
+
+    TileServerStats stats;
+    QMetaObject::invokeMethod(server, "stats", Qt::BlockingQueuedConnection, Q_RETURN_ARG(TileServerStats, stats));
+
+    out << "server,requests," << stats.requests << ",bytes_sent," << stats.bytesSent
+        << ",errors," << stats.errors << ",not_found," << stats.notFound
+        << ",not_modified," << stats.notModified << endl;
+
+    serverThread.quit();
+    serverThread.wait();
+
+    return 0;
+}
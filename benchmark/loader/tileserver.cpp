@@ -0,0 +1,299 @@
+#include "tileserver.h"
+
+#include <QCryptographicHash>
+#include <QTcpSocket>
+#include <QPainter>
+#include <QBuffer>
+#include <QImage>
+#include <QTimer>
+#include <QFile>
+#include <QHash>
+
+// bandwidth limited responses are written in chunks at this interval
+static const int CHUNK_INTERVAL = 50;
+
+struct Connection
+{
+    QByteArray buffer;
+    bool isBusy = false;
+};
+
+struct TileServer::TileServerPrivate
+{
+    int latency = 0;
+    int bandwidth = 0;
+    qreal errorRate = 0.;
+    uint seed = 0;
+    QString tilesPath;
+
+    QHash<QTcpSocket*, Connection> connections;
+    QHash<QString, QPair<QByteArray, QByteArray>> tiles; // (data, etag)
+    QHash<QString, int> attempts; // per path, failures depend on it
+    TileServerStats stats;
+};
+
+static QByteArray generateTile(int z, int x, int y)
+{
+    QImage image(256, 256, QImage::Format_RGB32);
+    image.fill(QColor::fromHsv((x * 37 + y * 101 + z * 13) % 360, 40, 235));
+
+    QPainter painter(&image);
+    painter.setPen(Qt::gray);
+    painter.drawRect(0, 0, 255, 255);
+    painter.setPen(Qt::black);
+    painter.drawText(image.rect(), Qt::AlignCenter, QString("%1/%2/%3").arg(z).arg(x).arg(y));
+    painter.end();
+
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, "PNG");
+
+    return data;
+}
+
+static QByteArray createResponse(int code, const QByteArray &reason, const QByteArray &body,
+                                 const QByteArray &etag, bool close)
+{
+    QByteArray response = "HTTP/1.1 " + QByteArray::number(code) + ' ' + reason + "\r\n";
+
+    if (!etag.isEmpty())
+        response += "ETag: " + etag + "\r\n";
+
+    if (code == 200)
+        response += "Content-Type: image/png\r\n";
+
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    response += close ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+    response += body;
+
+    return response;
+}
+
+TileServer::TileServer(QObject *parent) : QTcpServer(parent),
+    d(new TileServerPrivate)
+{
+}
+
+TileServer::~TileServer()
+{
+    delete d;
+}
+
+void TileServer::setLatency(int msec)
+{
+    d->latency = qMax(0, msec);
+}
+
+void TileServer::setBandwidth(int bytesPerSecond)
+{
+    d->bandwidth = qMax(0, bytesPerSecond);
+}
+
+void TileServer::setErrorRate(qreal rate)
+{
+    d->errorRate = qBound(0., rate, 1.);
+}
+
+void TileServer::setSeed(uint seed)
+{
+    d->seed = seed;
+}
+
+void TileServer::setTilesPath(const QString &path)
+{
+    d->tilesPath = path;
+    d->tiles.clear();
+}
+
+quint16 TileServer::start(quint16 port)
+{
+    return listen(QHostAddress::LocalHost, port) ? serverPort() : 0;
+}
+
+TileServerStats TileServer::stats() const
+{
+    return d->stats;
+}
+
+void TileServer::incomingConnection(qintptr handle)
+{
+    QTcpSocket *socket = new QTcpSocket(this);
+
+    if (!socket->setSocketDescriptor(handle))
+    {
+        delete socket;
+        return;
+    }
+
+    d->connections.insert(socket, Connection());
+
+    connect(socket, &QTcpSocket::readyRead, this, [this, socket]()
+    {
+        auto it = d->connections.find(socket);
+        if (it == d->connections.end()) return;
+
+        it.value().buffer += socket->readAll();
+        processRequest(socket);
+    });
+
+    connect(socket, &QTcpSocket::disconnected, this, [this, socket]()
+    {
+        d->connections.remove(socket);
+        socket->deleteLater();
+    });
+}
+
+// one request of the connection at a time, the next one waits in the buffer
+void TileServer::processRequest(QTcpSocket *socket)
+{
+    auto it = d->connections.find(socket);
+    if (it == d->connections.end() || it.value().isBusy) return;
+
+    Connection &connection = it.value();
+    const int end = connection.buffer.indexOf("\r\n\r\n");
+    if (end < 0) return;
+
+    const QList<QByteArray> lines = connection.buffer.left(end).split('\n');
+    connection.buffer.remove(0, end + 4);
+    connection.isBusy = true;
+
+    const QList<QByteArray> request = lines.first().trimmed().split(' ');
+    QByteArray ifNoneMatch;
+    bool close = request.value(2) == "HTTP/1.0";
+
+    for (int i=1; i<lines.size(); ++i)
+    {
+        const QByteArray line = lines.at(i).trimmed();
+        const int colon = line.indexOf(':');
+        if (colon < 0) continue;
+
+        const QByteArray name = line.left(colon).trimmed().toLower();
+        const QByteArray value = line.mid(colon + 1).trimmed();
+
+        if (name == "if-none-match")
+            ifNoneMatch = value;
+        else if (name == "connection")
+            close = value.toLower() == "close";
+    }
+
+    ++d->stats.requests;
+
+    const QString path = QString::fromUtf8(request.value(1));
+    const int attempt = d->attempts[path]++;
+    const uint hash = qHash(path + '#' + QString::number(attempt), d->seed);
+
+    QByteArray data;
+    QByteArray etag;
+    QByteArray response;
+
+    if (request.value(0) != "GET")
+    {
+        response = createResponse(405, "Method Not Allowed", QByteArray(), QByteArray(), close);
+    }
+    else if (static_cast<qreal>(hash % 10000) < d->errorRate * 10000.)
+    {
+        ++d->stats.errors;
+        response = createResponse(503, "Service Unavailable", QByteArray(), QByteArray(), close);
+    }
+    else if (!tile(path, data, etag))
+    {
+        ++d->stats.notFound;
+        response = createResponse(404, "Not Found", QByteArray(), QByteArray(), close);
+    }
+    else if (ifNoneMatch == etag)
+    {
+        ++d->stats.notModified;
+        response = createResponse(304, "Not Modified", QByteArray(), etag, close);
+    }
+    else response = createResponse(200, "OK", data, etag, close);
+
+    if (d->latency > 0)
+        QTimer::singleShot(d->latency, socket, [=]() { send(socket, response, close); });
+    else send(socket, response, close);
+}
+
+void TileServer::send(QTcpSocket *socket, const QByteArray &response, bool close)
+{
+    d->stats.bytesSent += static_cast<quint64>(response.size());
+
+    if (d->bandwidth <= 0)
+    {
+        socket->write(response);
+        finishResponse(socket, close);
+        return;
+    }
+
+    const int chunk = qMax(1, d->bandwidth * CHUNK_INTERVAL / 1000);
+    int offset = 0;
+
+    QTimer *timer = new QTimer(socket);
+    timer->setInterval(CHUNK_INTERVAL);
+
+    connect(timer, &QTimer::timeout, socket, [=]() mutable
+    {
+        socket->write(response.mid(offset, chunk));
+        offset += chunk;
+
+        if (offset < response.size()) return;
+
+        timer->stop();
+        timer->deleteLater();
+        finishResponse(socket, close);
+    });
+
+    timer->start();
+}
+
+void TileServer::finishResponse(QTcpSocket *socket, bool close)
+{
+    if (close)
+    {
+        socket->disconnectFromHost();
+        return;
+    }
+
+    auto it = d->connections.find(socket);
+    if (it == d->connections.end()) return;
+
+    it.value().isBusy = false;
+    processRequest(socket);
+}
+
+// "/z/x/y.png", generated tiles and files are kept in memory
+bool TileServer::tile(const QString &path, QByteArray &data, QByteArray &etag)
+{
+    auto it = d->tiles.constFind(path);
+
+    if (it != d->tiles.cend())
+    {
+        data = it.value().first;
+        etag = it.value().second;
+        return true;
+    }
+
+    const QStringList parts = path.split('/');
+    if (parts.size() != 4 || path.contains("..")) return false;
+
+    bool ok[3] = {false, false, false};
+    const int z = parts.at(1).toInt(&ok[0]);
+    const int x = parts.at(2).toInt(&ok[1]);
+    const int y = parts.at(3).section('.', 0, 0).toInt(&ok[2]);
+    if (!ok[0] || !ok[1] || !ok[2]) return false;
+
+    if (d->tilesPath.isEmpty())
+    {
+        data = generateTile(z, x, y);
+    }
+    else
+    {
+        QFile file(d->tilesPath + path);
+        if (!file.open(QIODevice::ReadOnly)) return false;
+        data = file.readAll();
+    }
+
+    etag = '"' + QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex() + '"';
+    d->tiles.insert(path, qMakePair(data, etag));
+
+    return true;
+}
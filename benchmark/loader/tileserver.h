@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QTcpServer>
+
+class QTcpSocket;
+
+//! \brief The TileServerStats struct, counters of served requests
+struct TileServerStats
+{
+    quint64 requests = 0;
+    quint64 notModified = 0; // answered 304 by ETag
+    quint64 errors = 0;      // injected by the error rate
+    quint64 notFound = 0;
+    quint64 bytesSent = 0;
+};
+
+//! \brief The TileServer class, a local HTTP/1.1 tile server standing in for
+//! the map providers. "GET /z/x/y.png" returns a file of tilesPath() or, if
+//! the path is empty, a generated PNG showing the tile position. Responses
+//! can be delayed, throttled and failed at a seeded rate, identical requests
+//! fail identically between runs. Tiles carry an ETag and If-None-Match is
+//! answered with 304.
+class TileServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    explicit TileServer(QObject *parent = Q_NULLPTR);
+    ~TileServer();
+
+    void setLatency(int msec); // before the first byte of each response
+    void setBandwidth(int bytesPerSecond); // per connection, 0 is unlimited
+    void setErrorRate(qreal rate); // 0..1 of the requests answered with 503
+    void setSeed(uint seed);
+    void setTilesPath(const QString &path);
+
+    Q_INVOKABLE quint16 start(quint16 port); // listens on localhost, 0 picks a free port, returns 0 on failure
+    Q_INVOKABLE TileServerStats stats() const;
+
+private:
+    void incomingConnection(qintptr handle);
+    void processRequest(QTcpSocket *socket);
+    void send(QTcpSocket *socket, const QByteArray &response, bool close);
+    void finishResponse(QTcpSocket *socket, bool close);
+    bool tile(const QString &path, QByteArray &data, QByteArray &etag);
+
+    struct TileServerPrivate;
+    TileServerPrivate * const d;
+};
+
+Q_DECLARE_METATYPE(TileServerStats)
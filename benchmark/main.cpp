@@ -0,0 +1,427 @@
+#include "mapgeodesic.h"
+#include "mapview.h"
+#include "mapglobal.h"
+#include "mapitem.h"
+
+#include <QTemporaryDir>
+#include <QApplication>
+#include <QPainter>
+#include <QtMath>
+#include <QtTest>
+
+Q_DECLARE_METATYPE(GeodesicMode)
+
+// tiles of this provider are never loaded, painting does not wait for the network
+static const char *ProviderBenchmark = "Benchmark";
+
+static QVector<QPointF> randomCoords(int count, const QRectF &bound)
+{
+    QVector<QPointF> coords;
+    coords.reserve(count);
+    qsrand(1);
+
+    for (int i=0; i<count; ++i)
+    {
+        coords.append(QPointF(bound.left() + bound.width() * qrand() / RAND_MAX,
+                              bound.top() + bound.height() * qrand() / RAND_MAX));
+    }
+
+    return coords;
+}
+
+// a winding track, consecutive points are close like in recorded routes
+static QVector<QPointF> trackCoords(int count)
+{
+    QVector<QPointF> coords;
+    coords.reserve(count);
+
+    for (int i=0; i<count; ++i)
+    {
+        const qreal angle = i * 0.001;
+        coords.append(QPointF(-21.94 + qCos(angle) * 0.5 + i * 1e-6, 64.15 + qSin(angle * 3.) * 0.2));
+    }
+
+    return coords;
+}
+
+// the same rows for the scalar and the batch cases, their results compare per row
+static void addCountRows()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("100k") << 100000;
+    QTest::newRow("1M") << 1000000;
+}
+
+// the count rows in both geodesic modes
+static void addGeodesicRows()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<GeodesicMode>("mode");
+
+    const QVector<QPair<QString, int>> counts = {{"1k", 1000}, {"100k", 100000}, {"1M", 1000000}};
+
+    for (const QPair<QString, int> &count: counts)
+    {
+        QTest::newRow((count.first + " spherical").toLatin1().constData()) << count.second << GeodesicMode::Spherical;
+        QTest::newRow((count.first + " ellipsoidal").toLatin1().constData()) << count.second << GeodesicMode::Ellipsoidal;
+    }
+}
+
+//! \brief The MapBenchmark class, QBENCHMARK cases of the projection, the tile
+//! grid and items. Results are machine readable with the QtTest loggers, for
+//! example "mapbenchmark -o results.xml,xml" or "mapbenchmark -csv".
+class MapBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void toPoint_data();
+    void toPoint();
+    void toCoords_data();
+    void toCoords();
+    void toPoints_data();
+    void toPoints();
+    void toCoordsBatch_data();
+    void toCoordsBatch();
+
+    void distance_data();
+    void distance();
+    void distances_data();
+    void distances();
+    void cumulativeLength_data();
+    void cumulativeLength();
+    void area_data();
+    void area();
+
+    void calculateUrl_data();
+    void calculateUrl();
+
+    void updateTilesPan();
+    void updateTilesZoom();
+
+    void setStaticPath_data();
+    void setStaticPath();
+
+    void paintViewport_data();
+    void paintViewport();
+
+private:
+    MapGlobal &settings = MapGlobal::instance();
+    QTemporaryDir cacheDir;
+};
+
+void MapBenchmark::initTestCase()
+{
+    QVERIFY(cacheDir.isValid());
+
+    settings.addProvider(ProviderBenchmark, {"http://127.0.0.1:9/{z}/{x}/{y}.png", "/benchmark", Spherical});
+    settings.setCachePath(cacheDir.path());
+}
+
+void MapBenchmark::toPoint_data()
+{
+    addCountRows();
+}
+
+void MapBenchmark::toPoint()
+{
+    QFETCH(int, count);
+
+    const QVector<QPointF> coords = randomCoords(count, QRectF(-180., -85., 360., 170.));
+    QPointF sum;
+
+    QBENCHMARK
+    {
+        for (const QPointF &point: coords)
+            sum += settings.toPoint(point);
+    }
+
+    QVERIFY(!qIsNaN(sum.x()));
+}
+
+void MapBenchmark::toCoords_data()
+{
+    addCountRows();
+}
+
+void MapBenchmark::toCoords()
+{
+    QFETCH(int, count);
+
+    const QVector<QPointF> points = settings.toPoints(randomCoords(count, QRectF(-180., -85., 360., 170.)));
+    QPointF sum;
+
+    QBENCHMARK
+    {
+        for (const QPointF &point: points)
+            sum += settings.toCoords(point);
+    }
+
+    QVERIFY(!qIsNaN(sum.x()));
+}
+
+void MapBenchmark::toPoints_data()
+{
+    addCountRows();
+}
+
+void MapBenchmark::toPoints()
+{
+    QFETCH(int, count);
+
+    const QVector<QPointF> coords = randomCoords(count, QRectF(-180., -85., 360., 170.));
+    QVector<QPointF> points(count);
+
+    QBENCHMARK
+    {
+        settings.toPoints(coords.constData(), points.data(), count);
+    }
+}
+
+void MapBenchmark::toCoordsBatch_data()
+{
+    addCountRows();
+}
+
+void MapBenchmark::toCoordsBatch()
+{
+    QFETCH(int, count);
+
+    const QVector<QPointF> points = settings.toPoints(randomCoords(count, QRectF(-180., -85., 360., 170.)));
+    QVector<QPointF> coords(count);
+
+    QBENCHMARK
+    {
+        settings.toCoordsBatch(points.constData(), coords.data(), count);
+    }
+}
+
+void MapBenchmark::distance_data()
+{
+    addCountRows();
+}
+
+// the scalar loop the MapGeodesic cases compare to, pairs of neighbours
+void MapBenchmark::distance()
+{
+    QFETCH(int, count);
+
+    const QVector<QPointF> coords = randomCoords(count + 1, QRectF(-24., 63., 10., 4.));
+    float sum = 0.f;
+
+    QBENCHMARK
+    {
+        for (int i=0; i<count; ++i)
+            sum += settings.distance(coords.at(i), coords.at(i + 1));
+    }
+
+    QVERIFY(sum > 0.f);
+}
+
+void MapBenchmark::distances_data()
+{
+    addGeodesicRows();
+}
+
+void MapBenchmark::distances()
+{
+    QFETCH(int, count);
+    QFETCH(GeodesicMode, mode);
+
+    const QVector<QPointF> coords = randomCoords(count + 1, QRectF(-24., 63., 10., 4.));
+    QVector<double> result(count);
+
+    QBENCHMARK
+    {
+        MapGeodesic::distances(coords.constData(), coords.constData() + 1, result.data(), count, mode);
+    }
+
+    QVERIFY(result.last() > 0.);
+}
+
+void MapBenchmark::cumulativeLength_data()
+{
+    addGeodesicRows();
+}
+
+void MapBenchmark::cumulativeLength()
+{
+    QFETCH(int, count);
+    QFETCH(GeodesicMode, mode);
+
+    const QVector<QPointF> coords = trackCoords(count);
+    QVector<double> result(count);
+
+    QBENCHMARK
+    {
+        MapGeodesic::cumulativeLength(coords.constData(), result.data(), count, mode);
+    }
+
+    QVERIFY(result.last() > 0.);
+}
+
+void MapBenchmark::area_data()
+{
+    addGeodesicRows();
+}
+
+void MapBenchmark::area()
+{
+    QFETCH(int, count);
+    QFETCH(GeodesicMode, mode);
+
+    const QVector<QPointF> coords = trackCoords(count);
+    double result = 0.;
+
+    QBENCHMARK
+    {
+        result = MapGeodesic::area(coords.constData(), count, mode);
+    }
+
+    QVERIFY(result > 0.);
+}
+
+void MapBenchmark::calculateUrl_data()
+{
+    QTest::addColumn<QString>("provider");
+
+    const QStringList providers = {ProviderGoogleMap, ProviderGoogleSat, ProviderGoogleLand,
+                                   ProviderBingSat, ProviderBingRoads, ProviderOsmMap,
+                                   ProviderYandexMap, ProviderYandexSat, ProviderStamenToner,
+                                   ProviderThunderforestTransport, ProviderThunderforestLandscape,
+                                   ProviderThunderforestOutdoors};
+
+    for (const QString &provider: providers)
+        QTest::newRow(provider.toLatin1().constData()) << provider;
+}
+
+void MapBenchmark::calculateUrl()
+{
+    QFETCH(QString, provider);
+    QVERIFY(settings.setCurrentProvider(provider));
+
+    QString url;
+
+    QBENCHMARK
+    {
+        for (int i=0; i<1000; ++i)
+            settings.calculateUrl(i, i * 7, 17, url);
+    }
+
+    QVERIFY(!url.isEmpty());
+}
+
+void MapBenchmark::updateTilesPan()
+{
+    MapObject map;
+    map.setTileWidth(settings.tileWidth());
+
+    int x = 1000;
+
+    // a 1920x1080 viewport moved by a tile per step
+    QBENCHMARK
+    {
+        map.setGeometry(QRect(x++, 1000, 10, 7));
+    }
+}
+
+void MapBenchmark::updateTilesZoom()
+{
+    MapObject map;
+    int zoom = 10;
+
+    QBENCHMARK
+    {
+        zoom = zoom < 18 ? zoom + 1 : 10;
+        const int center = 1 << (zoom - 1);
+
+        map.setTileWidth(settings.tileWidth() * qPow(2., settings.zoomMax() - zoom));
+        map.setGeometry(QRect(center - 5, center - 3, 10, 7));
+    }
+}
+
+void MapBenchmark::setStaticPath_data()
+{
+    addCountRows();
+}
+
+void MapBenchmark::setStaticPath()
+{
+    QFETCH(int, count);
+
+    QVERIFY(settings.setCurrentProvider(ProviderBenchmark));
+    const QVector<QPointF> coords = trackCoords(count);
+    MapItem item;
+
+    // large paths build their LOD levels in a worker, wait for them
+    QBENCHMARK
+    {
+        item.setStaticPath(coords);
+        item.waitForLevels();
+    }
+}
+
+void MapBenchmark::paintViewport_data()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("empty") << 0;
+    QTest::newRow("1k items") << 1000;
+    QTest::newRow("10k items") << 10000;
+}
+
+void MapBenchmark::paintViewport()
+{
+    QFETCH(int, count);
+
+    MapView view;
+    view.setProvider(ProviderBenchmark);
+    view.resize(1920, 1080);
+    view.setZoom(12);
+    view.setCenterOn(QPointF(-21.94, 64.15));
+    view.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&view));
+
+    // half dynamic points, half short static paths around the center
+    const QVector<QPointF> coords = randomCoords(count, QRectF(-22.34, 63.95, 0.8, 0.4));
+    QPixmap pixmap(16, 16);
+    pixmap.fill(Qt::red);
+
+    view.createItems(count, [&](MapItem *item, int i)
+    {
+        const QPointF &point = coords.at(i);
+
+        if (i % 2)
+        {
+            item->setPixmap(pixmap, pixmap.size());
+            item->move(point);
+        }
+        else item->setStaticPath({point, point + QPointF(0.01, 0.005), point + QPointF(0.02, 0.)});
+    });
+
+    QImage image(view.viewport()->size(), QImage::Format_ARGB32_Premultiplied);
+
+    QBENCHMARK
+    {
+        QPainter painter(&image);
+        view.render(&painter);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // no display is needed
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    MapBenchmark benchmark;
+
+    return QTest::qExec(&benchmark, argc, argv);
+}
+
+#include "main.moc"
@@ -0,0 +1,11 @@
+QT += core gui widgets network
+
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+TARGET = maprender
+
+SOURCES += \
+    main.cpp
+
+include(../src/MapView.pri);
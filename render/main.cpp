@@ -0,0 +1,202 @@
+#include "maprenderer.h"
+#include "mapglobal.h"
+
+#include <QCommandLineParser>
+#include <QApplication>
+#include <QTextStream>
+#include <QFuture>
+#include <QDebug>
+#include <QFile>
+
+struct RenderJob
+{
+    QString output;
+    QPointF center;
+    QPointF boundLeftTop;
+    QPointF boundRightBottom;
+    int zoom = 0; // 0 means fit to bound
+    QSize size;
+};
+
+static bool parseNumbers(const QString &text, int count, QVector<qreal> &values)
+{
+    const QStringList parts = text.split(',');
+    if (parts.size() != count) return false;
+
+    values.clear();
+    for (const QString &part: parts)
+    {
+        bool ok = false;
+        values.append(part.toDouble(&ok));
+        if (!ok) return false;
+    }
+
+    return true;
+}
+
+static bool parseSize(const QString &text, QSize &size)
+{
+    const QStringList parts = text.split('x');
+    if (parts.size() != 2) return false;
+
+    size = QSize(parts.at(0).toInt(), parts.at(1).toInt());
+    return !size.isEmpty();
+}
+
+// <output> center <lon>,<lat> <zoom> <width>x<height>
+// <output> bbox <lon1>,<lat1>,<lon2>,<lat2> <width>x<height>
+static bool parseJob(const QString &line, RenderJob &job)
+{
+    const QStringList args = line.simplified().split(' ');
+    if (args.size() < 4) return false;
+
+    QVector<qreal> values;
+    job.output = args.at(0);
+
+    if (args.at(1) == "center" && args.size() == 5)
+    {
+        if (!parseNumbers(args.at(2), 2, values)) return false;
+        job.center = QPointF(values.at(0), values.at(1));
+        job.zoom = args.at(3).toInt();
+        return job.zoom > 0 && parseSize(args.at(4), job.size);
+    }
+    else if (args.at(1) == "bbox" && args.size() == 4)
+    {
+        if (!parseNumbers(args.at(2), 4, values)) return false;
+        job.boundLeftTop = QPointF(values.at(0), values.at(1));
+        job.boundRightBottom = QPointF(values.at(2), values.at(3));
+        return parseSize(args.at(3), job.size);
+    }
+
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    // there is nothing to show, run without a display by default
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders static map images without a window");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"provider", "Map provider name.", "name", ProviderOsmMap},
+        {"cache", "Tile cache directory.", "path", "./tiles"},
+        {"center", "Map center.", "lon,lat"},
+        {"zoom", "Zoom level.", "zoom", "12"},
+        {"bbox", "Map bound, replaces center and zoom.", "lon1,lat1,lon2,lat2"},
+        {"size", "Image size.", "WxH", "800x600"},
+        {"output", "Output image file.", "file", "map.png"},
+        {"jobs", "File with one render job per line.", "file"},
+        {"threads", "Number of parallel renders.", "count"},
+        {"timeout", "Network timeout for one render, msec.", "msec", "10000"}
+    });
+    parser.process(a);
+
+    QVector<RenderJob> jobs;
+
+    if (parser.isSet("jobs"))
+    {
+        QFile file(parser.value("jobs"));
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        {
+            qWarning() << "can't open jobs file:" << file.fileName();
+            return 1;
+        }
+
+        QTextStream stream(&file);
+        while (!stream.atEnd())
+        {
+            const QString line = stream.readLine().trimmed();
+            if (line.isEmpty() || line.startsWith('#')) continue;
+
+            RenderJob job;
+            if (!parseJob(line, job))
+            {
+                qWarning() << "bad job:" << line;
+                return 1;
+            }
+
+            jobs.append(job);
+        }
+    }
+    else
+    {
+        RenderJob job;
+        QVector<qreal> values;
+        job.output = parser.value("output");
+
+        if (!parseSize(parser.value("size"), job.size))
+        {
+            qWarning() << "bad size:" << parser.value("size");
+            return 1;
+        }
+
+        if (parser.isSet("bbox"))
+        {
+            if (!parseNumbers(parser.value("bbox"), 4, values))
+            {
+                qWarning() << "bad bbox:" << parser.value("bbox");
+                return 1;
+            }
+
+            job.boundLeftTop = QPointF(values.at(0), values.at(1));
+            job.boundRightBottom = QPointF(values.at(2), values.at(3));
+        }
+        else if (parseNumbers(parser.value("center"), 2, values))
+        {
+            job.center = QPointF(values.at(0), values.at(1));
+            job.zoom = parser.value("zoom").toInt();
+
+            // zoom 0 means fit to bound, there is no bound in this mode
+            if (job.zoom <= 0)
+            {
+                qWarning() << "bad zoom:" << parser.value("zoom");
+                return 1;
+            }
+        }
+        else
+        {
+            qWarning() << "center or bbox is required";
+            parser.showHelp(1);
+        }
+
+        jobs.append(job);
+    }
+
+    MapRenderer renderer;
+    renderer.setCachePath(parser.value("cache"));
+    renderer.setTimeout(parser.value("timeout").toInt());
+
+    if (parser.isSet("threads"))
+        renderer.setMaxThreadCount(parser.value("threads").toInt());
+
+    if (!renderer.setProvider(parser.value("provider")))
+    {
+        qWarning() << "unknown provider:" << parser.value("provider");
+        return 1;
+    }
+
+    QVector<QFuture<QImage>> futures;
+    for (const RenderJob &job: qAsConst(jobs))
+    {
+        if (job.zoom > 0)
+            futures.append(renderer.renderAsync(job.center, job.zoom, job.size));
+        else futures.append(renderer.renderAsync(job.boundLeftTop, job.boundRightBottom, job.size));
+    }
+
+    int result = 0;
+    for (int i=0; i<futures.size(); ++i)
+    {
+        if (!futures[i].result().save(jobs.at(i).output))
+        {
+            qWarning() << "can't save:" << jobs.at(i).output;
+            result = 1;
+        }
+    }
+
+    return result;
+}
@@ -1,13 +1,47 @@
+QT += concurrent
+
+# vectorized batch projection, needs a CPU with AVX2
+mapview_simd:!msvc: QMAKE_CXXFLAGS_RELEASE += -O3 -mavx2 -mfma
+mapview_simd:msvc: QMAKE_CXXFLAGS_RELEASE += /arch:AVX2
+
 INCLUDEPATH += $$PWD
 
 SOURCES += \
+    $$PWD/mapclusterlayer.cpp \
+    $$PWD/mapgeodesic.cpp \
     $$PWD/mapglobal.cpp \
+    $$PWD/mapheatmaplayer.cpp \
+    $$PWD/mapiconatlas.cpp \
+    $$PWD/mapimporter.cpp \
     $$PWD/mapitem.cpp \
+    $$PWD/maplabellayer.cpp \
     $$PWD/maploader.cpp \
+    $$PWD/mapmarkerlayer.cpp \
+    $$PWD/mapoverlay.cpp \
+    $$PWD/maprenderer.cpp \
+    $$PWD/mapspatialindex.cpp \
+    $$PWD/mapstyle.cpp \
+    $$PWD/maptraillayer.cpp \
+    $$PWD/mapurltemplate.cpp \
     $$PWD/mapview.cpp
 
 HEADERS += \
+    $$PWD/mapclusterlayer.h \
+    $$PWD/mapgeodesic.h \
     $$PWD/mapglobal.h \
+    $$PWD/mapheatmaplayer.h \
+    $$PWD/mapiconatlas.h \
+    $$PWD/mapimporter.h \
     $$PWD/mapitem.h \
+    $$PWD/maplabellayer.h \
     $$PWD/maploader.h \
+    $$PWD/mapmarkerlayer.h \
+    $$PWD/mapoverlay.h \
+    $$PWD/mapmath.h \
+    $$PWD/mapprojection.h \
+    $$PWD/maprenderer.h \
+    $$PWD/mapspatialindex.h \
+    $$PWD/mapstyle.h \
+    $$PWD/maptraillayer.h \
+    $$PWD/mapurltemplate.h \
     $$PWD/mapview.h
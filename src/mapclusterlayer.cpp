@@ -0,0 +1,325 @@
+#include "mapclusterlayer.h"
+#include "mapitem.h"
+
+#include <QPainter>
+#include <QtMath>
+#include <QHash>
+
+struct ClusterEntry
+{
+    QPointF pos;
+    quint64 cell = 0;
+    int slot = 0;
+};
+
+struct Cluster
+{
+    QVector<MapItem*> items;
+    QPointF sum;
+};
+
+static inline quint64 cellKey(qint64 x, qint64 y)
+{
+    return (static_cast<quint64>(static_cast<quint32>(x)) << 32) | static_cast<quint32>(y);
+}
+
+struct MapClusterLayer::MapClusterLayerPrivate
+{
+    int cellSize = 64;
+    int minimumCount = 2;
+    qreal factor = 1.;
+
+    QPen pen = QPen(QBrush(QColor(Qt::white)), 2);
+    QBrush brush = QBrush(QColor(30, 110, 200, 200));
+    QFont font = QFont("mono", 10, QFont::Bold);
+    QColor color = QColor(Qt::white);
+
+    QRectF boundingRect;
+    QHash<MapItem*, ClusterEntry> entries;
+    QHash<quint64, Cluster> clusters;
+
+    qreal cellWidth() const { return cellSize * factor; }
+    quint64 cellOf(const QPointF &pos) const;
+    void insert(MapItem *item);
+    void remove(MapItem *item);
+    void update(MapItem *item);
+};
+
+quint64 MapClusterLayer::MapClusterLayerPrivate::cellOf(const QPointF &pos) const
+{
+    return cellKey(qFloor(pos.x() / cellWidth()), qFloor(pos.y() / cellWidth()));
+}
+
+void MapClusterLayer::MapClusterLayerPrivate::insert(MapItem *item)
+{
+    ClusterEntry entry;
+    entry.pos = item->pos();
+    entry.cell = cellOf(entry.pos);
+
+    Cluster &cluster = clusters[entry.cell];
+    entry.slot = cluster.items.size();
+    cluster.items.append(item);
+    cluster.sum += entry.pos;
+    entries.insert(item, entry);
+
+    if (cluster.items.size() == minimumCount)
+    {
+        for (MapItem *clustered: qAsConst(cluster.items))
+            clustered->setHiddenFlag(MapItem::Clustered, true);
+    }
+    else if (cluster.items.size() > minimumCount)
+        item->setHiddenFlag(MapItem::Clustered, true);
+}
+
+void MapClusterLayer::MapClusterLayerPrivate::remove(MapItem *item)
+{
+    auto it = entries.find(item);
+    if (it == entries.end()) return;
+
+    const ClusterEntry entry = it.value();
+    entries.erase(it);
+
+    auto clusterIt = clusters.find(entry.cell);
+    Cluster &cluster = clusterIt.value();
+
+    MapItem *last = cluster.items.last();
+    cluster.items[entry.slot] = last;
+    if (last != item) entries[last].slot = entry.slot;
+    cluster.items.removeLast();
+    cluster.sum -= entry.pos;
+
+    item->setHiddenFlag(MapItem::Clustered, false);
+
+    if (cluster.items.size() == minimumCount - 1)
+    {
+        for (MapItem *clustered: qAsConst(cluster.items))
+            clustered->setHiddenFlag(MapItem::Clustered, false);
+    }
+
+    if (cluster.items.isEmpty())
+        clusters.erase(clusterIt);
+}
+
+void MapClusterLayer::MapClusterLayerPrivate::update(MapItem *item)
+{
+    // static items and items hidden by the user are not clustered
+    const bool isClustered = !item->isStatic() && item->isVisible();
+    auto it = entries.find(item);
+
+    if (it == entries.end())
+    {
+        if (isClustered) insert(item);
+    }
+    else if (!isClustered)
+    {
+        remove(item);
+    }
+    else if (cellOf(item->pos()) == it.value().cell)
+    {
+        clusters[it.value().cell].sum += item->pos() - it.value().pos;
+        it.value().pos = item->pos();
+    }
+    else
+    {
+        remove(item);
+        insert(item);
+    }
+}
+
+MapClusterLayer::MapClusterLayer(QGraphicsItem *parent) : QGraphicsObject(parent),
+    d(new MapClusterLayerPrivate)
+{
+    setZValue(2);
+    setAcceptedMouseButtons(Qt::NoButton);
+}
+
+MapClusterLayer::~MapClusterLayer()
+{
+    clear();
+    delete d;
+}
+
+void MapClusterLayer::setCellSize(int pixels)
+{
+    d->cellSize = qMax(1, pixels);
+    regroup();
+}
+
+int MapClusterLayer::cellSize() const
+{
+    return d->cellSize;
+}
+
+void MapClusterLayer::setMinimumCount(int count)
+{
+    d->minimumCount = qMax(2, count);
+    regroup();
+}
+
+int MapClusterLayer::minimumCount() const
+{
+    return d->minimumCount;
+}
+
+void MapClusterLayer::setPen(const QPen &pen)
+{
+    d->pen = pen;
+    update();
+}
+
+void MapClusterLayer::setBrush(const QBrush &brush)
+{
+    d->brush = brush;
+    update();
+}
+
+void MapClusterLayer::setFont(const QFont &font)
+{
+    d->font = font;
+    update();
+}
+
+void MapClusterLayer::setColor(const QColor &color)
+{
+    d->color = color;
+    update();
+}
+
+void MapClusterLayer::insertItem(MapItem *item)
+{
+    item->setClusterLayer(this);
+    updateItem(item);
+}
+
+void MapClusterLayer::removeItem(MapItem *item)
+{
+    d->remove(item);
+    item->setClusterLayer(Q_NULLPTR);
+    update();
+}
+
+void MapClusterLayer::updateItem(MapItem *item)
+{
+    d->update(item);
+    update();
+}
+
+void MapClusterLayer::updateItems(const QVector<MapItem*> &items)
+{
+    for (MapItem *item: items)
+        d->update(item);
+
+    update();
+}
+
+void MapClusterLayer::clear()
+{
+    for (auto it = d->entries.cbegin(); it != d->entries.cend(); ++it)
+    {
+        it.key()->setHiddenFlag(MapItem::Clustered, false);
+        it.key()->setClusterLayer(Q_NULLPTR);
+    }
+
+    d->entries.clear();
+    d->clusters.clear();
+    update();
+}
+
+void MapClusterLayer::setFactor(qreal factor)
+{
+    if (qFuzzyCompare(d->factor, factor)) return;
+
+    d->factor = factor;
+    regroup();
+}
+
+void MapClusterLayer::setBoundingRect(const QRectF &rect)
+{
+    prepareGeometryChange();
+    d->boundingRect = rect;
+    update();
+}
+
+int MapClusterLayer::clustersCount() const
+{
+    int count = 0;
+
+    for (auto it = d->clusters.cbegin(); it != d->clusters.cend(); ++it)
+        if (it.value().items.size() >= d->minimumCount) ++count;
+
+    return count;
+}
+
+QRectF MapClusterLayer::boundingRect() const
+{
+    return d->boundingRect;
+}
+
+void MapClusterLayer::paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget)
+{
+    Q_UNUSED(item);
+    Q_UNUSED(widget);
+
+    const qreal width = d->cellWidth();
+    const qint64 left = qFloor(d->boundingRect.left() / width) - 1;
+    const qint64 right = qFloor(d->boundingRect.right() / width) + 1;
+    const qint64 top = qFloor(d->boundingRect.top() / width) - 1;
+    const qint64 bottom = qFloor(d->boundingRect.bottom() / width) + 1;
+
+    QVector<const Cluster*> visible;
+
+    if ((right - left + 1) * (bottom - top + 1) > d->clusters.size())
+    {
+        for (auto it = d->clusters.cbegin(); it != d->clusters.cend(); ++it)
+            visible.append(&it.value());
+    }
+    else
+    {
+        for (qint64 x=left; x<=right; ++x)
+        {
+            for (qint64 y=top; y<=bottom; ++y)
+            {
+                auto it = d->clusters.constFind(cellKey(x, y));
+                if (it != d->clusters.cend()) visible.append(&it.value());
+            }
+        }
+    }
+
+    painter->setRenderHint(QPainter::Antialiasing);
+    painter->setFont(d->font);
+
+    for (const Cluster *cluster: qAsConst(visible))
+    {
+        const int count = cluster->items.size();
+        if (count < d->minimumCount) continue;
+
+        // markers keep their size in pixels
+        const qreal radius = 12. + 4. * std::log2(static_cast<qreal>(count));
+        const QRectF rect(-radius, -radius, 2. * radius, 2. * radius);
+
+        painter->save();
+        painter->translate(cluster->sum / count);
+        painter->scale(d->factor, d->factor);
+
+        painter->setPen(d->pen);
+        painter->setBrush(d->brush);
+        painter->drawEllipse(rect);
+
+        painter->setPen(QPen(d->color));
+        painter->drawText(rect, Qt::AlignCenter, QString::number(count));
+        painter->restore();
+    }
+}
+
+void MapClusterLayer::regroup()
+{
+    const QList<MapItem*> items = d->entries.keys();
+
+    for (MapItem *item: items)
+        d->remove(item);
+
+    for (MapItem *item: items)
+        d->insert(item);
+
+    update();
+}
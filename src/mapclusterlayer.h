@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QGraphicsObject>
+#include <QBrush>
+#include <QFont>
+#include <QPen>
+
+class MapItem;
+
+//! \brief The MapClusterLayer class, groups dynamic point items by a grid of
+//! cellSize() pixels at the current zoom. Items of a cell with at least
+//! minimumCount() members are hidden and the cell is drawn as one marker with
+//! the count at their mean position. Moving items change their cell
+//! incrementally, a zoom change regroups all items.
+class MapClusterLayer : public QGraphicsObject
+{
+    Q_OBJECT
+public:
+    explicit MapClusterLayer(QGraphicsItem *parent = Q_NULLPTR);
+    ~MapClusterLayer();
+
+    void setCellSize(int pixels);
+    int cellSize() const;
+
+    void setMinimumCount(int count);
+    int minimumCount() const;
+
+    void setPen(const QPen &pen);
+    void setBrush(const QBrush &brush);
+    void setFont(const QFont &font);
+    void setColor(const QColor &color); // text color
+
+    void insertItem(MapItem *item);
+    void removeItem(MapItem *item);
+    void updateItem(MapItem *item);
+    void updateItems(const QVector<MapItem*> &items); // one repaint for all of them
+    void clear();
+
+    void setFactor(qreal factor);
+    void setBoundingRect(const QRectF &rect);
+
+    int clustersCount() const;
+
+private:
+    QRectF boundingRect() const;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget);
+    void regroup();
+
+    struct MapClusterLayerPrivate;
+    MapClusterLayerPrivate * const d;
+};
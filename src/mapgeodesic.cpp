@@ -0,0 +1,227 @@
+#include "mapgeodesic.h"
+#include "mapmath.h"
+
+#include <cmath>
+
+static const double MEAN_RADIUS = 6371008.8;            // IUGG mean earth radius
+static const double AUTHALIC_RADIUS = 6371007.180918;   // sphere with the WGS84 surface area
+static const double WGS84_A = 6378137.0;
+static const double WGS84_F = 1. / 298.257223563;
+static const double WGS84_B = WGS84_A * (1. - WGS84_F);
+static const double DEG_TO_RAD = MapMath::Pi / 180.;
+static const int BLOCK_SIZE = 256;
+
+static inline double normalizeLon(double rLon)
+{
+    return rLon - 2. * MapMath::Pi * MapMath::round(rLon / (2. * MapMath::Pi));
+}
+
+// geodetic to authalic latitude, series in the WGS84 eccentricity
+static inline double authalic(double rLat)
+{
+    const double s = MapMath::sin(rLat);
+    const double c = MapMath::cos(rLat);
+    const double sin2 = 2. * s * c;
+    const double cos2 = c * c - s * s;
+    const double sin4 = 2. * sin2 * cos2;
+    const double sin6 = sin4 * cos2 + (cos2 * cos2 - sin2 * sin2) * sin2;
+
+    return rLat - 2.239209695832593e-03 * sin2 + 2.130774967842507e-06 * sin4 - 2.533126097493167e-09 * sin6;
+}
+
+static inline double haversine(double lon1, double lat1, double lon2, double lat2)
+{
+    const double rLat1 = lat1 * DEG_TO_RAD;
+    const double rLat2 = lat2 * DEG_TO_RAD;
+    const double dLon = normalizeLon((lon2 - lon1) * DEG_TO_RAD);
+
+    const double sLat = MapMath::sin((rLat2 - rLat1) * 0.5);
+    const double sLon = MapMath::sin(dLon * 0.5);
+    const double a = sLat * sLat + MapMath::cos(rLat1) * MapMath::cos(rLat2) * sLon * sLon;
+
+    return 2. * MEAN_RADIUS * MapMath::atan(std::sqrt(a) / std::sqrt(std::fabs(1. - a)));
+}
+
+static double vincenty(double lon1, double lat1, double lon2, double lat2)
+{
+    const double L = normalizeLon((lon2 - lon1) * DEG_TO_RAD);
+    const double U1 = std::atan((1. - WGS84_F) * std::tan(lat1 * DEG_TO_RAD));
+    const double U2 = std::atan((1. - WGS84_F) * std::tan(lat2 * DEG_TO_RAD));
+    const double sinU1 = std::sin(U1), cosU1 = std::cos(U1);
+    const double sinU2 = std::sin(U2), cosU2 = std::cos(U2);
+
+    double lambda = L;
+    double sinSigma = 0., cosSigma = 0., sigma = 0., cos2Alpha = 0., cos2SigmaM = 0.;
+
+    for (int i=0; i<100; ++i)
+    {
+        const double sinLambda = std::sin(lambda);
+        const double cosLambda = std::cos(lambda);
+        const double t = cosU1 * sinU2 - sinU1 * cosU2 * cosLambda;
+
+        sinSigma = std::sqrt(cosU2 * sinLambda * cosU2 * sinLambda + t * t);
+        if (sinSigma == 0.) return 0.;
+
+        cosSigma = sinU1 * sinU2 + cosU1 * cosU2 * cosLambda;
+        sigma = std::atan2(sinSigma, cosSigma);
+
+        const double sinAlpha = cosU1 * cosU2 * sinLambda / sinSigma;
+        cos2Alpha = 1. - sinAlpha * sinAlpha;
+        cos2SigmaM = cos2Alpha != 0. ? cosSigma - 2. * sinU1 * sinU2 / cos2Alpha : 0.;
+
+        const double C = WGS84_F / 16. * cos2Alpha * (4. + WGS84_F * (4. - 3. * cos2Alpha));
+        const double previous = lambda;
+        lambda = L + (1. - C) * WGS84_F * sinAlpha *
+                (sigma + C * sinSigma * (cos2SigmaM + C * cosSigma * (-1. + 2. * cos2SigmaM * cos2SigmaM)));
+
+        if (std::fabs(lambda - previous) < 1e-12)
+        {
+            const double u2 = cos2Alpha * (WGS84_A * WGS84_A - WGS84_B * WGS84_B) / (WGS84_B * WGS84_B);
+            const double A = 1. + u2 / 16384. * (4096. + u2 * (-768. + u2 * (320. - 175. * u2)));
+            const double B = u2 / 1024. * (256. + u2 * (-128. + u2 * (74. - 47. * u2)));
+            const double dSigma = B * sinSigma * (cos2SigmaM + B / 4. *
+                    (cosSigma * (-1. + 2. * cos2SigmaM * cos2SigmaM) - B / 6. * cos2SigmaM *
+                     (-3. + 4. * sinSigma * sinSigma) * (-3. + 4. * cos2SigmaM * cos2SigmaM)));
+
+            return WGS84_B * A * (sigma - dSigma);
+        }
+    }
+
+    // nearly antipodal points, Vincenty does not converge
+    return haversine(lon1, lat1, lon2, lat2);
+}
+
+static void segmentDistances(const QPointF *coords1, const QPointF *coords2, double *result,
+                             int count, GeodesicMode mode)
+{
+    if (mode == GeodesicMode::Ellipsoidal)
+    {
+        for (int i=0; i<count; ++i)
+            result[i] = vincenty(coords1[i].x(), coords1[i].y(), coords2[i].x(), coords2[i].y());
+    }
+    else
+    {
+        for (int i=0; i<count; ++i)
+            result[i] = haversine(coords1[i].x(), coords1[i].y(), coords2[i].x(), coords2[i].y());
+    }
+}
+
+// signed spherical excess of the edges coords1[i] -> coords2[i], edges are great circles
+static void edgeExcess(const QPointF *coords1, const QPointF *coords2, double *result,
+                       int count, GeodesicMode mode)
+{
+    const double ellipsoidal = mode == GeodesicMode::Ellipsoidal ? 1. : 0.;
+
+    for (int i=0; i<count; ++i)
+    {
+        double rLat1 = coords1[i].y() * DEG_TO_RAD;
+        double rLat2 = coords2[i].y() * DEG_TO_RAD;
+        rLat1 += ellipsoidal * (authalic(rLat1) - rLat1);
+        rLat2 += ellipsoidal * (authalic(rLat2) - rLat2);
+
+        const double dLon = normalizeLon((coords2[i].x() - coords1[i].x()) * DEG_TO_RAD) * 0.5;
+        const double t1 = MapMath::sin(rLat1 * 0.5) / MapMath::cos(rLat1 * 0.5);
+        const double t2 = MapMath::sin(rLat2 * 0.5) / MapMath::cos(rLat2 * 0.5);
+        const double tLon = MapMath::sin(dLon) / MapMath::cos(dLon);
+
+        result[i] = 2. * MapMath::atan(tLon * (t1 + t2) / (1. + t1 * t2));
+    }
+}
+
+// sum of kernel(begin, size, out) outputs over [0, count), in blocks per thread
+template <typename Kernel>
+static double parallelSum(int count, Kernel kernel)
+{
+    QVector<double> sums(count / MapMath::ChunkSize + 1, 0.);
+    double *data = sums.data();
+
+    MapMath::parallelFor(count, [&](int begin, int end) {
+        double block[BLOCK_SIZE];
+        double sum = 0.;
+
+        for (int i=begin; i<end; i+=BLOCK_SIZE)
+        {
+            const int size = qMin(BLOCK_SIZE, end - i);
+            kernel(i, size, block);
+
+            for (int j=0; j<size; ++j)
+                sum += block[j];
+        }
+
+        data[begin / MapMath::ChunkSize] = sum;
+    });
+
+    double result = 0.;
+    for (double sum: qAsConst(sums))
+        result += sum;
+
+    return result;
+}
+
+double MapGeodesic::distance(const QPointF &coords1, const QPointF &coords2, GeodesicMode mode)
+{
+    double result = 0.;
+    segmentDistances(&coords1, &coords2, &result, 1, mode);
+    return result;
+}
+
+void MapGeodesic::distances(const QPointF *coords1, const QPointF *coords2, double *result,
+                            int count, GeodesicMode mode)
+{
+    MapMath::parallelFor(count, [=](int begin, int end) {
+        segmentDistances(coords1 + begin, coords2 + begin, result + begin, end - begin, mode);
+    });
+}
+
+void MapGeodesic::cumulativeLength(const QPointF *coords, double *result, int count, GeodesicMode mode)
+{
+    if (count <= 0) return;
+
+    result[0] = 0.;
+    distances(coords, coords + 1, result + 1, count - 1, mode);
+
+    for (int i=1; i<count; ++i)
+        result[i] += result[i - 1];
+}
+
+double MapGeodesic::length(const QPointF *coords, int count, GeodesicMode mode)
+{
+    if (count < 2) return 0.;
+
+    return parallelSum(count - 1, [=](int begin, int size, double *out) {
+        segmentDistances(coords + begin, coords + begin + 1, out, size, mode);
+    });
+}
+
+double MapGeodesic::area(const QPointF *coords, int count, GeodesicMode mode)
+{
+    if (count < 3) return 0.;
+
+    double excess = parallelSum(count - 1, [=](int begin, int size, double *out) {
+        edgeExcess(coords + begin, coords + begin + 1, out, size, mode);
+    });
+
+    double closing = 0.;
+    edgeExcess(coords + count - 1, coords, &closing, 1, mode);
+    excess += closing;
+
+    const double radius = mode == GeodesicMode::Ellipsoidal ? AUTHALIC_RADIUS : MEAN_RADIUS;
+    return std::fabs(excess) * radius * radius;
+}
+
+QVector<double> MapGeodesic::cumulativeLength(const QVector<QPointF> &coords, GeodesicMode mode)
+{
+    QVector<double> result(coords.size());
+    cumulativeLength(coords.constData(), result.data(), coords.size(), mode);
+    return result;
+}
+
+double MapGeodesic::length(const QVector<QPointF> &coords, GeodesicMode mode)
+{
+    return length(coords.constData(), coords.size(), mode);
+}
+
+double MapGeodesic::area(const QVector<QPointF> &coords, GeodesicMode mode)
+{
+    return area(coords.constData(), coords.size(), mode);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QVector>
+#include <QPointF>
+
+enum class GeodesicMode
+{
+    Spherical = 0, // haversine on the mean earth sphere
+    Ellipsoidal    // Vincenty on WGS84, areas on the authalic sphere
+};
+
+//! \brief The MapGeodesic class, distances in meters and areas in square meters
+//! between QPointF(longitude, latitude). Array functions are vectorizable in
+//! Spherical mode and split across threads for large inputs.
+class MapGeodesic
+{
+public:
+    static double distance(const QPointF &coords1, const QPointF &coords2,
+                           GeodesicMode mode = GeodesicMode::Spherical);
+
+    // result[i] = distance(coords1[i], coords2[i])
+    static void distances(const QPointF *coords1, const QPointF *coords2, double *result,
+                          int count, GeodesicMode mode = GeodesicMode::Spherical);
+
+    // result[i] = length of the polyline from coords[0] to coords[i]
+    static void cumulativeLength(const QPointF *coords, double *result,
+                                 int count, GeodesicMode mode = GeodesicMode::Spherical);
+
+    static double length(const QPointF *coords, int count,
+                         GeodesicMode mode = GeodesicMode::Spherical);
+
+    // polygon is closed implicitly, the result is positive for any orientation
+    static double area(const QPointF *coords, int count,
+                       GeodesicMode mode = GeodesicMode::Spherical);
+
+    static QVector<double> cumulativeLength(const QVector<QPointF> &coords,
+                                            GeodesicMode mode = GeodesicMode::Spherical);
+    static double length(const QVector<QPointF> &coords, GeodesicMode mode = GeodesicMode::Spherical);
+    static double area(const QVector<QPointF> &coords, GeodesicMode mode = GeodesicMode::Spherical);
+};
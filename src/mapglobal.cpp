@@ -1,21 +1,22 @@
 #include "mapglobal.h"
+#include "mapprojection.h"
+#include "mapurltemplate.h"
 #include <QtMath>
 #include <QtCore>
 
 static const float EARTH_RADIUS_SK42 = 6371109.0;   // усредненный радиус земли SK42
-static const float EARTH_RADIUS_WGS84 = 6378137.0;  // усредненный радиус земли WGS84
-static const double MERCATOR_QUARTER = 20037508.3427892430765884088807;  //2*PI*6378137/(2^z)
 
 struct MapGlobal::MapGlobalPrivate
 {
     QMap<QString, Provider> providers;
     Provider provider;
+    MapUrlTemplate urlTemplate;
     QString providerName;
     QString cachePath;
-    int zoomMax = 23;
+    int zoomMax = MapProjection::ZoomMax;
     int zoom = zoomMax;
-    int tileWidth = 256;
-    int tilesCount = qPow(2., static_cast<qreal>(zoom)) / 2.; // 2097152
+    int tileWidth = MapProjection::TileWidth;
+    int tilesCount = MapProjection::TilesCount; // 2097152
     qreal factor = 1;
 };
 
@@ -72,10 +73,16 @@ bool MapGlobal::setCurrentProvider(const QString &name)
 
     d->providerName = name;
     d->provider = d->providers.value(name);
+    d->urlTemplate = MapUrlTemplate(d->provider.url, d->provider.subdomains, d->provider.retina);
 
     return true;
 }
 
+CoordsTypes MapGlobal::coordsType() const
+{
+    return d->provider.coordsType;
+}
+
 QString MapGlobal::cachePath() const
 {
     return d->cachePath;
@@ -91,10 +98,25 @@ void MapGlobal::setCachePath(const QString &path)
     d->cachePath = path;
 }
 
+QString MapGlobal::tileCachePath(const QPoint &pos, int zoom) const
+{
+    return tileCachePath(d->provider.cachePathSuffix, pos, zoom);
+}
+
+QString MapGlobal::tileCachePath(const QString &cachePathSuffix, const QPoint &pos, int zoom)
+{
+    return cachePathSuffix + QString("/z%1/%2/x%3/%4/y%5.png").arg(zoom).
+            arg(pos.x()/1024).arg(pos.x()).arg(pos.y()/1024).arg(pos.y());
+}
+
 void MapGlobal::calculateUrl(int x, int y, int z, QString &url)
 {
-    url = d->provider.url;
-    d->provider.calcUrlFunc(x, y, z, url);
+    if (d->provider.calcUrlFunc)
+    {
+        url = d->provider.url;
+        d->provider.calcUrlFunc(x, y, z, url);
+    }
+    else d->urlTemplate.format(x, y, z, url);
 }
 
 void MapGlobal::addProvider(const QString &name, const Provider &provider)
@@ -107,126 +129,93 @@ void MapGlobal::removeProvider(const QString &name)
     d->providers.remove(name);
 }
 
-QPointF MapGlobal::toCoords(const QPointF &point)
+bool MapGlobal::findProvider(const QString &name, Provider &provider) const
 {
-    qreal tileWidth = static_cast<qreal>(d->tileWidth);
-    qreal tilesCount = static_cast<qreal>(d->tilesCount);
-
-    qreal lon = (point.x() - tileWidth / 2) / (tilesCount * tileWidth) * 360. - 180.;
-    qreal lat = 0;
+    auto it = d->providers.constFind(name);
+    if (it == d->providers.cend()) return false;
 
-    if (d->provider.coordsType == CoordsTypes::Ellipsoidal)
-    {
-        double c1 = 0.00335655146887969;
-        double c2 = 0.00000657187271079536;
-        double c3 = 0.00000001764564338702;
-        double c4 = 0.00000000005328478445;
-
-        double mercY = MERCATOR_QUARTER - (point.y() * pow(2, 24 - d->zoomMax)) / 53.5865938;
-        double g = M_PI / 2 - 2 * atan(1 / exp(mercY / EARTH_RADIUS_WGS84));
-        double zz = g + c1 * sin(2 * g) + c2 * sin(4 * g) + c3 * sin(6 * g) + c4 * sin(8 * g);
-        lat = zz * 180 / M_PI;
-    }
-    else
-    {
-        lat = M_PI - 2. * M_PI * (point.y() - tileWidth / 2) / (tilesCount * tileWidth);
-        lat = 180. / M_PI * atan(0.5 * (exp(lat) - exp(-lat)));
-    }
+    provider = it.value();
+    return true;
+}
 
-    return QPointF(lon, lat);
+QPointF MapGlobal::toCoords(const QPointF &point)
+{
+    return MapProjection::dispatch(d->provider.coordsType, [&](auto projection) {
+        return MapProjection::toCoords<decltype(projection)>(point);
+    });
 }
 
 QPointF MapGlobal::toPoint(const QPointF &coords)
 {
-    qreal tileWidth = static_cast<qreal>(d->tileWidth);
-    qreal tilesCount = static_cast<qreal>(d->tilesCount);
-
-    qreal x = (coords.x() + 180.) * (tilesCount * tileWidth) / 360.;
-    x += tileWidth / 2;
+    return MapProjection::dispatch(d->provider.coordsType, [&](auto projection) {
+        return MapProjection::toPoint<decltype(projection)>(coords);
+    });
+}
 
-    qreal y = 0;
+void MapGlobal::toPoints(const QPointF *coords, QPointF *points, int count)
+{
+    toPoints(coords, points, count, d->provider.coordsType);
+}
 
-    if (d->provider.coordsType == CoordsTypes::Ellipsoidal)
-    {
-        double rLat = coords.y() * M_PI / 180;
-        double k = 0.0818191908426;
+void MapGlobal::toPoints(const QPointF *coords, QPointF *points, int count, CoordsTypes type)
+{
+    MapProjection::dispatch(type, [=](auto projection) {
+        MapMath::parallelFor(count, [=](int begin, int end) {
+            MapProjection::toPoints<decltype(projection)>(coords + begin, points + begin, end - begin);
+        });
+    });
+}
 
-        double zz = tan(M_PI / 4 + rLat / 2)  / pow((tan(M_PI / 4 + asin(k * sin(rLat)) / 2)), k);
-        y = static_cast<int>((20037508.342789 - EARTH_RADIUS_WGS84 * log(zz)) * 53.5865938 / pow(2, 24 - d->zoomMax));
-    }
-    else
-    {
-        y = (1. - log(tan(coords.y() * M_PI / 180.) + 1. /
-             cos(coords.y() * M_PI / 180.)) / M_PI) / 2. * (tilesCount * tileWidth);
+void MapGlobal::toCoordsBatch(const QPointF *points, QPointF *coords, int count)
+{
+    MapProjection::dispatch(d->provider.coordsType, [=](auto projection) {
+        MapMath::parallelFor(count, [=](int begin, int end) {
+            MapProjection::toCoords<decltype(projection)>(points + begin, coords + begin, end - begin);
+        });
+    });
+}
 
-        y += tileWidth / 2;
-    }
+QVector<QPointF> MapGlobal::toPoints(const QVector<QPointF> &coords)
+{
+    QVector<QPointF> points(coords.size());
+    toPoints(coords.constData(), points.data(), coords.size());
+    return points;
+}
 
-    return QPoint(x, y);
+QVector<QPointF> MapGlobal::toCoordsBatch(const QVector<QPointF> &points)
+{
+    QVector<QPointF> coords(points.size());
+    toCoordsBatch(points.constData(), coords.data(), points.size());
+    return coords;
 }
 
 float MapGlobal::distance(const QPointF &coords1, const QPointF &coords2)
 {
-    if (qFuzzyCompare(coords1.x(), coords2.x()) &&
-        qFuzzyCompare(coords1.y(), coords2.y())) return 0.f;
-
-    double x1 = qDegreesToRadians(coords1.x());
-    double y1 = qDegreesToRadians(coords1.y());
-    double x2 = qDegreesToRadians(coords2.x());
-    double y2 = qDegreesToRadians(coords2.y());
+    // haversine keeps precision at short ranges where acos(cos) loses it
+    const double y1 = qDegreesToRadians(coords1.y());
+    const double y2 = qDegreesToRadians(coords2.y());
+    const double sinLat = qSin((y2 - y1) / 2.);
+    const double sinLon = qSin(qDegreesToRadians(coords2.x() - coords1.x()) / 2.);
 
-    double sin1 = qSin(y1);
-    double cos1 = qCos(y1);
-    double sin2 = qSin(y2);
-    double cos2 = qCos(y2);
-
-    double cos21 = qCos(x2 - x1);
-    double d1 = sin1;
-    double d2 = cos1;
-
-    d1 *= sin2;
-    d2 *= cos2;
-    d2 *= cos21;
-    d1 += d2;
-
-    d1 = EARTH_RADIUS_SK42 * qAcos(d1);
-
-    return d1;
+    const double a = sinLat * sinLat + qCos(y1) * qCos(y2) * sinLon * sinLon;
+    return EARTH_RADIUS_SK42 * 2. * qAtan2(qSqrt(a), qSqrt(qAbs(1. - a)));
 }
 
 MapGlobal::MapGlobal() :
     d(new MapGlobalPrivate)
-{    
-    auto calcUrlFuncMain = [](int x, int y, int z, QString &url) {
-        url = url.arg(x).arg(y).arg(z);
-    };
-
-    auto calcUrlFuncBing = [](int x, int y, int z, QString &url) {
-        QString key;
-        for (int i = z; i > 0; i--)
-        {
-            char digit = '0';
-            int mask = 1 << (i - 1);
-            if ((x & mask) != 0) digit++;
-            if ((y & mask) != 0) digit += 2;
-
-            key.append(digit);
-        }
-        url = (url.arg(key));
-    };
-
-    addProvider(ProviderGoogleMap, {"http://mt0.google.com/vt/lyrs=m&hl=en&x=%1&y=%2&z=%3", "/map", Spherical, calcUrlFuncMain});
-    addProvider(ProviderGoogleSat, {"http://mt0.google.com/vt/lyrs=y&hl=en&x=%1&y=%2&z=%3", "/sat", Spherical, calcUrlFuncMain});
-    addProvider(ProviderGoogleLand, {"http://mt0.google.com/vt/lyrs=p&hl=en&x=%1&y=%2&z=%3", "/land", Spherical, calcUrlFuncMain});
-    addProvider(ProviderBingSat, {"http://ecn.t0.tiles.virtualearth.net/tiles/a%1.jpeg?g=0", "/vesat", Spherical, calcUrlFuncBing});
-    addProvider(ProviderBingRoads, {"http://ecn.dynamic.t0.tiles.virtualearth.net/comp/CompositionHandler/%1?mkt=en-en&it=G,VE,BX,L,LA&shading=hill", "/bing_roads_en", Spherical, calcUrlFuncBing});
-    addProvider(ProviderOsmMap, {"https://tile.openstreetmap.org/%3/%1/%2.png", "/osm", Spherical, calcUrlFuncMain});
-    addProvider(ProviderYandexMap, {"http://vec04.maps.yandex.net/tiles?l=map&lang=en-EN&v=2.26.0&x=%1&y=%2&z=%3", "/yam", Ellipsoidal, calcUrlFuncMain});
-    addProvider(ProviderYandexSat, {"http://sat01.maps.yandex.net/tiles?l=sat&v=3.379.0&x=%1&y=%2&z=%3", "/yas", Ellipsoidal, calcUrlFuncMain});
-    addProvider(ProviderStamenToner, {"http://a.tile.stamen.com/toner/%3/%1/%2.png", "/stamen", Spherical, calcUrlFuncMain});
-    addProvider(ProviderThunderforestTransport, {"http://tile.thunderforest.com/transport/%3/%1/%2.png", "/tht", Spherical, calcUrlFuncMain});
-    addProvider(ProviderThunderforestLandscape, {"http://tile.thunderforest.com/landscape/%3/%1/%2.png", "/thl", Spherical, calcUrlFuncMain});
-    addProvider(ProviderThunderforestOutdoors, {"http://tile.thunderforest.com/outdoors/%3/%1/%2.png", "/tho", Spherical, calcUrlFuncMain});
+{
+    addProvider(ProviderGoogleMap, {"http://mt0.google.com/vt/lyrs=m&hl=en&x={x}&y={y}&z={z}", "/map", Spherical});
+    addProvider(ProviderGoogleSat, {"http://mt0.google.com/vt/lyrs=y&hl=en&x={x}&y={y}&z={z}", "/sat", Spherical});
+    addProvider(ProviderGoogleLand, {"http://mt0.google.com/vt/lyrs=p&hl=en&x={x}&y={y}&z={z}", "/land", Spherical});
+    addProvider(ProviderBingSat, {"http://ecn.t0.tiles.virtualearth.net/tiles/a{quadkey}.jpeg?g=0", "/vesat", Spherical});
+    addProvider(ProviderBingRoads, {"http://ecn.dynamic.t0.tiles.virtualearth.net/comp/CompositionHandler/{quadkey}?mkt=en-en&it=G,VE,BX,L,LA&shading=hill", "/bing_roads_en", Spherical});
+    addProvider(ProviderOsmMap, {"https://tile.openstreetmap.org/{z}/{x}/{y}.png", "/osm", Spherical});
+    addProvider(ProviderYandexMap, {"http://vec04.maps.yandex.net/tiles?l=map&lang=en-EN&v=2.26.0&x={x}&y={y}&z={z}", "/yam", Ellipsoidal});
+    addProvider(ProviderYandexSat, {"http://sat01.maps.yandex.net/tiles?l=sat&v=3.379.0&x={x}&y={y}&z={z}", "/yas", Ellipsoidal});
+    addProvider(ProviderStamenToner, {"http://{s}.tile.stamen.com/toner/{z}/{x}/{y}.png", "/stamen", Spherical, Q_NULLPTR, {"a", "b", "c"}});
+    addProvider(ProviderThunderforestTransport, {"http://tile.thunderforest.com/transport/{z}/{x}/{y}.png", "/tht", Spherical});
+    addProvider(ProviderThunderforestLandscape, {"http://tile.thunderforest.com/landscape/{z}/{x}/{y}.png", "/thl", Spherical});
+    addProvider(ProviderThunderforestOutdoors, {"http://tile.thunderforest.com/outdoors/{z}/{x}/{y}.png", "/tho", Spherical});
 }
 
 MapGlobal::~MapGlobal()
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <QStringList>
 #include <QObject>
+#include <QVector>
+#include <QPointF>
 #include <functional>
 
 static const char* ProviderGoogleMap = "GoogleMap";
@@ -18,16 +21,20 @@ static const char* ProviderThunderforestOutdoors = "ThunderforestOutdoors";
 
 enum CoordsTypes
 {
-    Spherical,
-    Ellipsoidal
+    Spherical,      // Web Mercator, EPSG:3857
+    Ellipsoidal,    // World Mercator, EPSG:3395
+    Equirectangular // plate carree, EPSG:4326
 };
 
+// url is a MapUrlTemplate pattern, or a QString::arg() pattern when calcUrlFunc is set
 struct Provider
 {
     QString url;
     QString cachePathSuffix;
     CoordsTypes coordsType = Spherical;
     std::function<void(int, int, int, QString&)> calcUrlFunc;
+    QStringList subdomains;
+    QString retina;
 };
 
 class MapGlobal
@@ -47,19 +54,33 @@ public:
 
     QString providerName() const;
     bool setCurrentProvider(const QString &name);
+    CoordsTypes coordsType() const;
 
     QString cachePath() const;
     QString cachePathSuffix() const;
     void setCachePath(const QString &path);
+    QString tileCachePath(const QPoint &pos, int zoom) const;
+    static QString tileCachePath(const QString &cachePathSuffix, const QPoint &pos, int zoom);
 
     void calculateUrl(int x, int y, int z, QString &url);
 
     void addProvider(const QString &name, const Provider &provider);
     void removeProvider(const QString &name);
+    bool findProvider(const QString &name, Provider &provider) const;
 
     QPointF toCoords(const QPointF &point);
     QPointF toPoint(const QPointF &coords);
 
+    // Batch versions of toPoint() and toCoords() for contiguous arrays, large
+    // inputs are split across threads. For latitudes within +-85.06 results
+    // differ from the scalar functions by less than 1e-4 scene units and
+    // 1e-12 degrees. Loops are vectorized with CONFIG += mapview_simd.
+    void toPoints(const QPointF *coords, QPointF *points, int count);
+    void toPoints(const QPointF *coords, QPointF *points, int count, CoordsTypes type);
+    void toCoordsBatch(const QPointF *points, QPointF *coords, int count);
+    QVector<QPointF> toPoints(const QVector<QPointF> &coords);
+    QVector<QPointF> toCoordsBatch(const QVector<QPointF> &points);
+
     float distance(const QPointF &coords1, const QPointF &coords2);
 
 protected:
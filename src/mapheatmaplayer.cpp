@@ -0,0 +1,443 @@
+#include "mapheatmaplayer.h"
+#include "mapglobal.h"
+
+#include <QtConcurrentMap>
+#include <QPainter>
+#include <QCache>
+#include <QImage>
+#include <QtMath>
+#include <QHash>
+#include <algorithm>
+
+// pixels per density cell, the grids are drawn smoothly scaled
+static const int HEATMAP_CELL_SIZE = 2;
+
+// more points added at once drop the cached grids instead of updating them
+static const int INCREMENTAL_POINTS = 4096;
+
+struct HeatTile
+{
+    QVector<float> grid; // rows of cells
+    float peak = 0.f;
+    QImage image;
+    float imageMaximum = -1.f; // maximum the image was colored with
+};
+
+struct HeatTask
+{
+    quint64 key;
+    QPoint pos;
+    HeatTile *tile;
+};
+
+static inline quint64 tileKey(int zoom, const QPoint &pos)
+{
+    return (static_cast<quint64>(zoom) << 56) |
+           (static_cast<quint64>(pos.x() & 0xfffffff) << 28) |
+            static_cast<quint64>(pos.y() & 0xfffffff);
+}
+
+static inline QPoint keyPos(quint64 key)
+{
+    return QPoint(static_cast<int>((key >> 28) & 0xfffffff), static_cast<int>(key & 0xfffffff));
+}
+
+// adds the kernel centered on cell (cx, cy), rows are contiguous so the inner
+// loop is a plain multiply-add the compiler vectorizes
+static void splat(float *grid, int size, const float *kernel, int radius, int cx, int cy, float weight)
+{
+    const int left = qMax(cx - radius, 0);
+    const int right = qMin(cx + radius, size - 1);
+    const int top = qMax(cy - radius, 0);
+    const int bottom = qMin(cy + radius, size - 1);
+    if (left > right || top > bottom) return;
+
+    const int side = radius * 2 + 1;
+    const int count = right - left + 1;
+
+    for (int y=top; y<=bottom; ++y)
+    {
+        float *row = grid + y * size + left;
+        const float *weights = kernel + (y - cy + radius) * side + (left - cx + radius);
+
+        for (int x=0; x<count; ++x)
+            row[x] += weight * weights[x];
+    }
+}
+
+struct MapHeatmapLayer::MapHeatmapLayerPrivate
+{
+    MapGlobal &settings = MapGlobal::instance();
+    QRectF boundingRect;
+
+    int radius = 24;
+    qreal maximum = 0.;
+    QGradientStops gradient;
+    QVector<QRgb> colors; // premultiplied, 256 steps of the gradient
+
+    // one row per point
+    QVector<QPointF> coords;
+    QVector<QPointF> points;
+    QVector<float> weights;
+
+    int kernelRadius = 0; // cells
+    QVector<float> kernel;
+
+    int bucketsZoom = -1; // point indices by the tile of this zoom
+    QHash<quint64, QVector<int>> buckets;
+
+    QCache<quint64, HeatTile> tiles; // cost in kilobytes
+    QHash<int, float> peaks; // densest computed cell per zoom
+
+    int gridSize() const { return settings.tileWidth() / HEATMAP_CELL_SIZE; }
+    qreal tileWidth(int zoom) const { return settings.tileWidth() * qPow(2., static_cast<qreal>(settings.zoomMax() - zoom)); }
+
+    void updateKernel();
+    void updateColors();
+    void updateBuckets(int zoom);
+    void bucket(int index);
+    void accumulate(HeatTile *tile, int zoom, const QPoint &pos, int index) const;
+    void colorize(HeatTile *tile, float maximum) const;
+};
+
+void MapHeatmapLayer::MapHeatmapLayerPrivate::updateKernel()
+{
+    kernelRadius = qMax(1, radius / HEATMAP_CELL_SIZE);
+
+    const int side = kernelRadius * 2 + 1;
+    const float radius2 = static_cast<float>(kernelRadius * kernelRadius);
+    kernel.resize(side * side);
+
+    for (int y=0; y<side; ++y)
+    {
+        for (int x=0; x<side; ++x)
+        {
+            const float dx = static_cast<float>(x - kernelRadius);
+            const float dy = static_cast<float>(y - kernelRadius);
+            const float distance2 = (dx * dx + dy * dy) / radius2;
+            kernel[y * side + x] = distance2 < 1.f ? (1.f - distance2) * (1.f - distance2) : 0.f;
+        }
+    }
+}
+
+void MapHeatmapLayer::MapHeatmapLayerPrivate::updateColors()
+{
+    QImage line(256, 1, QImage::Format_ARGB32_Premultiplied);
+    line.fill(Qt::transparent);
+
+    QLinearGradient linear(0., 0., 256., 0.);
+    linear.setStops(gradient);
+
+    QPainter painter(&line);
+    painter.fillRect(line.rect(), linear);
+    painter.end();
+
+    const QRgb *pixels = reinterpret_cast<const QRgb*>(line.constScanLine(0));
+    colors = QVector<QRgb>(pixels, pixels + 256);
+}
+
+void MapHeatmapLayer::MapHeatmapLayerPrivate::updateBuckets(int zoom)
+{
+    if (bucketsZoom == zoom) return;
+
+    bucketsZoom = zoom;
+    buckets.clear();
+
+    for (int i=0; i<points.size(); ++i)
+        bucket(i);
+}
+
+void MapHeatmapLayer::MapHeatmapLayerPrivate::bucket(int index)
+{
+    const qreal width = tileWidth(bucketsZoom);
+    const QPointF &point = points.at(index);
+    buckets[tileKey(bucketsZoom, QPoint(qFloor(point.x() / width), qFloor(point.y() / width)))].append(index);
+}
+
+void MapHeatmapLayer::MapHeatmapLayerPrivate::accumulate(HeatTile *tile, int zoom, const QPoint &pos, int index) const
+{
+    const int size = gridSize();
+    const qreal width = tileWidth(zoom);
+    const qreal cell = width / size;
+    const QPointF &point = points.at(index);
+
+    splat(tile->grid.data(), size, kernel.constData(), kernelRadius,
+          qFloor((point.x() - pos.x() * width) / cell),
+          qFloor((point.y() - pos.y() * width) / cell), weights.at(index));
+}
+
+void MapHeatmapLayer::MapHeatmapLayerPrivate::colorize(HeatTile *tile, float maximum) const
+{
+    const int size = gridSize();
+
+    if (tile->image.width() != size)
+        tile->image = QImage(size, size, QImage::Format_ARGB32_Premultiplied);
+
+    const float scale = maximum > 0.f ? 255.f / maximum : 0.f;
+    const float *grid = tile->grid.constData();
+
+    for (int y=0; y<size; ++y)
+    {
+        QRgb *line = reinterpret_cast<QRgb*>(tile->image.scanLine(y));
+
+        for (int x=0; x<size; ++x)
+            line[x] = colors.at(qBound(0, static_cast<int>(grid[y * size + x] * scale), 255));
+    }
+
+    tile->imageMaximum = maximum;
+}
+
+MapHeatmapLayer::MapHeatmapLayer(QGraphicsItem *parent) : QGraphicsObject(parent),
+    d(new MapHeatmapLayerPrivate)
+{
+    // above the map and static items, under markers
+    setZValue(0.5);
+    setAcceptedMouseButtons(Qt::NoButton);
+
+    d->tiles.setMaxCost(32 * 1024);
+    d->gradient << QGradientStop(0., QColor(0, 0, 255, 0))
+                << QGradientStop(0.2, QColor(0, 0, 255, 160))
+                << QGradientStop(0.4, QColor(0, 255, 255, 190))
+                << QGradientStop(0.6, QColor(0, 255, 0, 210))
+                << QGradientStop(0.8, QColor(255, 255, 0, 220))
+                << QGradientStop(1., QColor(255, 0, 0, 230));
+
+    d->updateKernel();
+    d->updateColors();
+}
+
+MapHeatmapLayer::~MapHeatmapLayer()
+{
+    delete d;
+}
+
+void MapHeatmapLayer::setRadius(int pixels)
+{
+    d->radius = qBound(1, pixels, d->settings.tileWidth());
+    d->updateKernel();
+    invalidate();
+}
+
+int MapHeatmapLayer::radius() const
+{
+    return d->radius;
+}
+
+void MapHeatmapLayer::setMaximum(qreal density)
+{
+    d->maximum = qMax(0., density);
+    update();
+}
+
+qreal MapHeatmapLayer::maximum() const
+{
+    return d->maximum;
+}
+
+void MapHeatmapLayer::setGradient(const QGradientStops &stops)
+{
+    d->gradient = stops;
+    d->updateColors();
+
+    const QList<quint64> keys = d->tiles.keys();
+    for (quint64 key: keys)
+        d->tiles.object(key)->imageMaximum = -1.f;
+
+    update();
+}
+
+QGradientStops MapHeatmapLayer::gradient() const
+{
+    return d->gradient;
+}
+
+void MapHeatmapLayer::setCacheSize(int kilobytes)
+{
+    d->tiles.setMaxCost(qMax(0, kilobytes));
+}
+
+int MapHeatmapLayer::cacheSize() const
+{
+    return d->tiles.maxCost();
+}
+
+void MapHeatmapLayer::addPoint(const QPointF &coords, qreal weight)
+{
+    addPoints(QVector<QPointF>() << coords, QVector<qreal>() << weight);
+}
+
+void MapHeatmapLayer::addPoints(const QVector<QPointF> &coords, const QVector<qreal> &weights)
+{
+    if (coords.isEmpty()) return;
+
+    const int first = d->points.size();
+    d->coords += coords;
+    d->points.resize(d->coords.size());
+    d->settings.toPoints(coords.constData(), d->points.data() + first, coords.size());
+
+    d->weights.reserve(d->coords.size());
+    for (int i=0; i<coords.size(); ++i)
+        d->weights.append(i < weights.size() ? static_cast<float>(weights.at(i)) : 1.f);
+
+    if (coords.size() > INCREMENTAL_POINTS)
+    {
+        invalidate();
+        return;
+    }
+
+    if (d->bucketsZoom >= 0)
+    {
+        for (int i=first; i<d->points.size(); ++i)
+            d->bucket(i);
+    }
+
+    // the new points are added into the cached grids they reach
+    const QList<quint64> keys = d->tiles.keys();
+    for (quint64 key: keys)
+    {
+        const int zoom = static_cast<int>(key >> 56);
+        const QPoint pos = keyPos(key);
+        const qreal width = d->tileWidth(zoom);
+        const qreal margin = width / d->gridSize() * (d->kernelRadius + 1);
+        const QRectF rect = QRectF(pos.x() * width, pos.y() * width, width, width).adjusted(-margin, -margin, margin, margin);
+
+        HeatTile *tile = d->tiles.object(key);
+        bool isChanged = false;
+
+        for (int i=first; i<d->points.size(); ++i)
+        {
+            if (!rect.contains(d->points.at(i))) continue;
+
+            d->accumulate(tile, zoom, pos, i);
+            isChanged = true;
+        }
+
+        if (!isChanged) continue;
+
+        tile->peak = *std::max_element(tile->grid.constBegin(), tile->grid.constEnd());
+        tile->imageMaximum = -1.f;
+        d->peaks[zoom] = qMax(d->peaks.value(zoom), tile->peak);
+    }
+
+    update();
+}
+
+void MapHeatmapLayer::clear()
+{
+    d->coords.clear();
+    d->points.clear();
+    d->weights.clear();
+    invalidate();
+}
+
+int MapHeatmapLayer::count() const
+{
+    return d->points.size();
+}
+
+void MapHeatmapLayer::updateCoords()
+{
+    d->settings.toPoints(d->coords.constData(), d->points.data(), d->coords.size());
+    invalidate();
+}
+
+void MapHeatmapLayer::setBoundingRect(const QRectF &rect)
+{
+    prepareGeometryChange();
+    d->boundingRect = rect;
+    update();
+}
+
+QRectF MapHeatmapLayer::boundingRect() const
+{
+    return d->boundingRect;
+}
+
+void MapHeatmapLayer::paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget)
+{
+    Q_UNUSED(item);
+    Q_UNUSED(widget);
+
+    if (d->points.isEmpty()) return;
+
+    const int zoom = d->settings.zoom();
+    const int size = d->gridSize();
+    const qreal width = d->tileWidth(zoom);
+    const QRect range(QPoint(qMax(0, qFloor(d->boundingRect.left() / width)),
+                             qMax(0, qFloor(d->boundingRect.top() / width))),
+                      QPoint(qFloor(d->boundingRect.right() / width),
+                             qFloor(d->boundingRect.bottom() / width)));
+
+    QVector<HeatTask> tasks;
+
+    for (int x=range.left(); x<=range.right(); ++x)
+    {
+        for (int y=range.top(); y<=range.bottom(); ++y)
+        {
+            const quint64 key = tileKey(zoom, QPoint(x, y));
+            if (!d->tiles.contains(key))
+                tasks.append({key, QPoint(x, y), new HeatTile});
+        }
+    }
+
+    if (!tasks.isEmpty())
+    {
+        d->updateBuckets(zoom);
+
+        // the kernel is not wider than a tile, the neighbour buckets hold all points reaching it
+        QtConcurrent::blockingMap(tasks, [this, zoom, size](HeatTask &task)
+        {
+            task.tile->grid.fill(0.f, size * size);
+
+            for (int x=task.pos.x()-1; x<=task.pos.x()+1; ++x)
+            {
+                for (int y=task.pos.y()-1; y<=task.pos.y()+1; ++y)
+                {
+                    auto it = d->buckets.constFind(tileKey(zoom, QPoint(x, y)));
+                    if (it == d->buckets.cend()) continue;
+
+                    for (int index: it.value())
+                        d->accumulate(task.tile, zoom, task.pos, index);
+                }
+            }
+
+            task.tile->peak = *std::max_element(task.tile->grid.constBegin(), task.tile->grid.constEnd());
+        });
+
+        for (const HeatTask &task: qAsConst(tasks))
+        {
+            d->peaks[zoom] = qMax(d->peaks.value(zoom), task.tile->peak);
+            d->tiles.insert(task.key, task.tile, qMax(1, size * size * 8 / 1024));
+        }
+    }
+
+    const float maximum = d->maximum > 0. ? static_cast<float>(d->maximum) : d->peaks.value(zoom);
+
+    painter->save();
+    painter->setRenderHint(QPainter::SmoothPixmapTransform);
+
+    for (int x=range.left(); x<=range.right(); ++x)
+    {
+        for (int y=range.top(); y<=range.bottom(); ++y)
+        {
+            HeatTile *tile = d->tiles.object(tileKey(zoom, QPoint(x, y)));
+            if (!tile || tile->peak <= 0.f) continue;
+
+            if (!qFuzzyCompare(tile->imageMaximum, maximum))
+                d->colorize(tile, maximum);
+
+            painter->drawImage(QRectF(x * width, y * width, width, width), tile->image);
+        }
+    }
+
+    painter->restore();
+}
+
+void MapHeatmapLayer::invalidate()
+{
+    d->tiles.clear();
+    d->peaks.clear();
+    d->buckets.clear();
+    d->bucketsZoom = -1;
+    update();
+}
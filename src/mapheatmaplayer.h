@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QGraphicsObject>
+#include <QGradient>
+#include <QVector>
+
+//! \brief The MapHeatmapLayer class, draws the density of weighted points.
+//! The density is a quartic kernel sum sampled on grids aligned with the map
+//! tiles, the missing tiles of the viewport are computed in parallel and
+//! cached per zoom. New points are added into the cached grids, earlier
+//! points are not summed again.
+class MapHeatmapLayer : public QGraphicsObject
+{
+    Q_OBJECT
+public:
+    explicit MapHeatmapLayer(QGraphicsItem *parent = Q_NULLPTR);
+    ~MapHeatmapLayer();
+
+    void setRadius(int pixels); // up to the tile width
+    int radius() const;
+
+    void setMaximum(qreal density); // 0 maps the densest cached cell of the zoom to the last color
+    qreal maximum() const;
+
+    void setGradient(const QGradientStops &stops); // density 0..1 to color
+    QGradientStops gradient() const;
+
+    void setCacheSize(int kilobytes);
+    int cacheSize() const;
+
+    void addPoint(const QPointF &coords, qreal weight = 1.); // QPointF(longitude, latitude)
+    void addPoints(const QVector<QPointF> &coords, const QVector<qreal> &weights = QVector<qreal>());
+    void clear();
+    int count() const;
+
+    void updateCoords();
+    void setBoundingRect(const QRectF &rect);
+
+private:
+    QRectF boundingRect() const;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget);
+    void invalidate();
+
+    struct MapHeatmapLayerPrivate;
+    MapHeatmapLayerPrivate * const d;
+};
@@ -0,0 +1,231 @@
+#include "mapiconatlas.h"
+
+#include <QCryptographicHash>
+#include <QPainter>
+#include <QBitmap>
+#include <QVector>
+#include <QCache>
+#include <QHash>
+#include <QPair>
+
+static const int ATLAS_PAGE_SIZE = 1024;
+// free pixels around each icon, smooth transforms do not pick the neighbours
+static const int ATLAS_SPACING = 1;
+
+// icons are drawn into the image, the pixmap is converted from it on demand
+struct AtlasPage
+{
+    QImage image;
+    QPixmap pixmap;
+    bool isPixmapValid = false;
+    int x = 0;
+    int y = 0;
+    int shelfHeight = 0;
+};
+
+struct MapIconAtlas::MapIconAtlasPrivate
+{
+    QVector<AtlasPage> pages;
+    int shared = -1; // page taking the next icons, large icons have pages of their own
+    int maxSize = 64 * 1024; // kilobytes of pages
+    int pagesSize = 0;
+
+    QHash<QPair<QByteArray, qint64>, MapIcon> icons; // (source pixels hash, size)
+    QCache<qint64, QByteArray> sourceHashes; // by source cache key, a pixmap is hashed once
+    QVector<QRegion> masks;
+    QVector<bool> hasMask;
+
+    QByteArray sourceHash(const QPixmap &source);
+    QRect allocate(const QSize &size, int &page);
+    bool addPage(int width, int height);
+};
+
+// equal pixels share an icon however the pixmap was created
+QByteArray MapIconAtlas::MapIconAtlasPrivate::sourceHash(const QPixmap &source)
+{
+    if (QByteArray *hash = sourceHashes.object(source.cacheKey()))
+        return *hash;
+
+    const QImage image = source.toImage().convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    hash.addData(QByteArray::number(image.width()) + 'x' + QByteArray::number(image.height()));
+
+    for (int y=0; y<image.height(); ++y)
+        hash.addData(reinterpret_cast<const char*>(image.constScanLine(y)), image.width() * 4);
+
+    QByteArray *result = new QByteArray(hash.result());
+    sourceHashes.insert(source.cacheKey(), result);
+
+    return *result;
+}
+
+// false if the page does not fit into maxSize
+bool MapIconAtlas::MapIconAtlasPrivate::addPage(int width, int height)
+{
+    const int cost = width * height * 4 / 1024;
+    if (pagesSize + cost > maxSize) return false;
+
+    AtlasPage page;
+    page.image = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
+    page.image.fill(Qt::transparent);
+    pages.append(page);
+    pagesSize += cost;
+
+    return true;
+}
+
+// shelf packing, a new page when the last one is full
+QRect MapIconAtlas::MapIconAtlasPrivate::allocate(const QSize &size, int &page)
+{
+    const int width = size.width() + ATLAS_SPACING * 2;
+    const int height = size.height() + ATLAS_SPACING * 2;
+
+    page = -1;
+
+    if (width > ATLAS_PAGE_SIZE || height > ATLAS_PAGE_SIZE)
+    {
+        if (!addPage(width, height)) return QRect();
+
+        page = pages.size() - 1;
+        return QRect(QPoint(ATLAS_SPACING, ATLAS_SPACING), size);
+    }
+
+    if (shared >= 0)
+    {
+        AtlasPage &current = pages[shared];
+
+        if (current.x + width > ATLAS_PAGE_SIZE)
+        {
+            current.x = 0;
+            current.y += current.shelfHeight;
+            current.shelfHeight = 0;
+        }
+
+        if (current.y + height > ATLAS_PAGE_SIZE)
+            shared = -1;
+    }
+
+    if (shared < 0)
+    {
+        if (!addPage(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE)) return QRect();
+        shared = pages.size() - 1;
+    }
+
+    AtlasPage &current = pages[shared];
+    const QRect rect(QPoint(current.x + ATLAS_SPACING, current.y + ATLAS_SPACING), size);
+
+    current.x += width;
+    current.shelfHeight = qMax(current.shelfHeight, height);
+
+    page = shared;
+    return rect;
+}
+
+MapIconAtlas &MapIconAtlas::instance()
+{
+    static MapIconAtlas atlas;
+    return atlas;
+}
+
+MapIconAtlas::MapIconAtlas() :
+    d(new MapIconAtlasPrivate)
+{
+    d->sourceHashes.setMaxCost(1024);
+}
+
+MapIconAtlas::~MapIconAtlas()
+{
+    delete d;
+}
+
+MapIcon MapIconAtlas::icon(const QPixmap &source, const QSize &size)
+{
+    if (source.isNull() || size.isEmpty()) return MapIcon();
+
+    const QPair<QByteArray, qint64> key(d->sourceHash(source),
+                                        (static_cast<qint64>(size.width()) << 32) | size.height());
+
+    auto it = d->icons.constFind(key);
+    if (it != d->icons.cend()) return it.value();
+
+    MapIcon icon;
+    icon.rect = d->allocate(size, icon.page);
+    if (icon.page < 0) return MapIcon();
+
+    icon.id = d->masks.size();
+
+    AtlasPage &page = d->pages[icon.page];
+    page.isPixmapValid = false;
+
+    QPainter painter(&page.image);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawPixmap(icon.rect, source, source.rect());
+    painter.end();
+
+    d->masks.append(QRegion());
+    d->hasMask.append(false);
+    d->icons.insert(key, icon);
+
+    return icon;
+}
+
+MapIcon MapIconAtlas::icon(const QPixmap &source)
+{
+    return icon(source, source.size());
+}
+
+const QPixmap &MapIconAtlas::page(int index) const
+{
+    static const QPixmap empty;
+    if (index < 0 || index >= d->pages.size()) return empty;
+
+    AtlasPage &page = d->pages[index];
+
+    if (!page.isPixmapValid)
+    {
+        page.pixmap = QPixmap::fromImage(page.image);
+        page.isPixmapValid = true;
+    }
+
+    return page.pixmap;
+}
+
+const QImage &MapIconAtlas::pageImage(int index) const
+{
+    static const QImage empty;
+    return index >= 0 && index < d->pages.size() ? d->pages.at(index).image : empty;
+}
+
+int MapIconAtlas::pagesCount() const
+{
+    return d->pages.size();
+}
+
+void MapIconAtlas::setMaxSize(int kilobytes)
+{
+    d->maxSize = qMax(0, kilobytes);
+}
+
+int MapIconAtlas::maxSize() const
+{
+    return d->maxSize;
+}
+
+int MapIconAtlas::size() const
+{
+    return d->pagesSize;
+}
+
+QRegion MapIconAtlas::mask(const MapIcon &icon)
+{
+    if (icon.id < 0 || icon.id >= d->masks.size()) return QRegion();
+
+    if (!d->hasMask.at(icon.id))
+    {
+        d->masks[icon.id] = QRegion(QBitmap::fromImage(pageImage(icon.page).copy(icon.rect).createAlphaMask()));
+        d->hasMask[icon.id] = true;
+    }
+
+    return d->masks.at(icon.id);
+}
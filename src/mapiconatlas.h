@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QPixmap>
+#include <QRegion>
+#include <QImage>
+#include <QRect>
+
+//! \brief The MapIcon struct, region of an icon in a MapIconAtlas page
+struct MapIcon
+{
+    int id = -1;
+    int page = -1;
+    QRect rect;
+
+    bool isNull() const { return id < 0; }
+};
+
+//! \brief The MapIconAtlas class, icons rasterized once per source pixels and
+//! size into a few shared pages. Items and layers keep MapIcon regions and
+//! draw from the page pixmap, so identical markers share one texture, also
+//! when their pixmaps are created separately. Used from the GUI thread.
+//! Icons are never evicted; once the pages reach maxSize() new icons are not
+//! added and icon() returns a null MapIcon. Copies of the page images may be
+//! read by other threads, icons added later are painted into a detached page.
+class MapIconAtlas
+{
+public:
+    static MapIconAtlas &instance();
+
+    MapIcon icon(const QPixmap &source, const QSize &size);
+    MapIcon icon(const QPixmap &source); // in its own size
+
+    const QPixmap &page(int index) const;
+    const QImage &pageImage(int index) const;
+    int pagesCount() const;
+
+    void setMaxSize(int kilobytes); // of all pages, 64 MB by default
+    int maxSize() const;
+    int size() const; // kilobytes
+    QRegion mask(const MapIcon &icon); // opaque part, in icon coords
+
+private:
+    MapIconAtlas();
+    ~MapIconAtlas();
+
+    struct MapIconAtlasPrivate;
+    MapIconAtlasPrivate * const d;
+};
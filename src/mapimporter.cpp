@@ -0,0 +1,591 @@
+#include "mapimporter.h"
+#include "mapview.h"
+#include "mapitem.h"
+
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
+#include <QWaitCondition>
+#include <QJsonDocument>
+#include <QtEndian>
+#include <QJsonArray>
+#include <QSaveFile>
+#include <QFuture>
+#include <QPointer>
+#include <QMutex>
+#include <QQueue>
+#include <QFile>
+#include <cstring>
+
+// header of the binary format, records follow it up to the end of the file:
+// type u8, closed u8, reserved u16, points u32, properties size u32,
+// points as little endian doubles (longitude, latitude), properties as compact JSON
+static const char BINARY_MAGIC[4] = {'M', 'V', 'G', 'B'};
+static const quint32 BINARY_VERSION = 1;
+static const int BINARY_HEADER_SIZE = 8;
+static const int RECORD_HEADER_SIZE = 12;
+
+// parsed batches waiting for the GUI thread, the reader stops when there are more
+static const int MAX_QUEUED_BATCHES = 4;
+
+struct ImportedFeature
+{
+    MapItemType type = MapItemType::DynamicItem;
+    bool closed = false;
+    QVector<QPointF> coords;
+    QJsonObject properties;
+    MapItemGeometry geometry; // static items
+    QPointF point;            // dynamic items
+};
+
+struct ImportTask
+{
+    QByteArray source; // a GeoJSON feature or a binary record, not a copy of the file
+    QVector<ImportedFeature> features;
+    QByteArray record; // features in the binary format
+};
+
+struct ImportBatch
+{
+    QVector<ImportedFeature> features;
+    qint64 bytesRead = 0;
+};
+
+struct MapImporter::MapImportJob
+{
+    QObject *receiver = Q_NULLPTR;
+    const char *data = Q_NULLPTR;
+    qint64 size = 0;
+    bool isBinary = false;
+    int batchSize = 0;
+    CoordsTypes coordsType = Spherical;
+    QString binaryOutput;
+
+    QAtomicInt isCanceled;
+    QMutex mutex;
+    QWaitCondition drained;
+    QQueue<ImportBatch> batches;
+    bool isDone = false;
+    QString error;
+};
+
+/*** binary values ***/
+
+template <typename T>
+static inline void appendValue(QByteArray &out, T value)
+{
+    const T le = qToLittleEndian(value);
+    out.append(reinterpret_cast<const char*>(&le), sizeof(T));
+}
+
+static inline void appendDouble(QByteArray &out, double value)
+{
+    quint64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    appendValue(out, bits);
+}
+
+template <typename T>
+static inline T readValue(const char *data)
+{
+    return qFromLittleEndian<T>(reinterpret_cast<const uchar*>(data));
+}
+
+static inline double readDouble(const char *data)
+{
+    const quint64 bits = readValue<quint64>(data);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void writeRecord(QByteArray &out, const ImportedFeature &feature)
+{
+    const QByteArray properties = feature.properties.isEmpty() ?
+                QByteArray() : QJsonDocument(feature.properties).toJson(QJsonDocument::Compact);
+
+    appendValue(out, static_cast<quint8>(feature.type));
+    appendValue(out, static_cast<quint8>(feature.closed));
+    appendValue(out, static_cast<quint16>(0));
+    appendValue(out, static_cast<quint32>(feature.coords.size()));
+    appendValue(out, static_cast<quint32>(properties.size()));
+
+    for (const QPointF &point: feature.coords)
+    {
+        appendDouble(out, point.x());
+        appendDouble(out, point.y());
+    }
+
+    out.append(properties);
+}
+
+// size of the record at data, -1 if it does not fit into size
+static qint64 recordSize(const char *data, qint64 size)
+{
+    if (size < RECORD_HEADER_SIZE) return -1;
+
+    const qint64 points = readValue<quint32>(data + 4);
+    const qint64 properties = readValue<quint32>(data + 8);
+    const qint64 total = RECORD_HEADER_SIZE + points * 16 + properties;
+
+    return total <= size ? total : -1;
+}
+
+static void readRecord(const QByteArray &record, QVector<ImportedFeature> &features)
+{
+    const char *data = record.constData();
+    const quint8 type = readValue<quint8>(data);
+    if (type > static_cast<quint8>(MapItemType::StaticEllipse)) return;
+
+    ImportedFeature feature;
+    feature.type = static_cast<MapItemType>(type);
+    feature.closed = readValue<quint8>(data + 1) != 0;
+
+    const int points = static_cast<int>(readValue<quint32>(data + 4));
+    const int properties = static_cast<int>(readValue<quint32>(data + 8));
+    data += RECORD_HEADER_SIZE;
+
+    feature.coords.resize(points);
+    for (int i=0; i<points; ++i, data += 16)
+        feature.coords[i] = QPointF(readDouble(data), readDouble(data + 8));
+
+    if (properties > 0)
+        feature.properties = QJsonDocument::fromJson(QByteArray::fromRawData(data, properties)).object();
+
+    if (!feature.coords.isEmpty())
+        features.append(feature);
+}
+
+/*** GeoJSON ***/
+
+//! \brief The GeoJsonScanner struct, finds the objects of the "features" array
+//! of a FeatureCollection without parsing them
+struct GeoJsonScanner
+{
+    const char *data = Q_NULLPTR;
+    qint64 size = 0;
+    qint64 pos = 0;
+    int depth = 0;
+    bool hasFeatures = false;
+    bool inFeatures = false;
+    qint64 featureStart = -1;
+    QByteArray lastString; // of the root object
+
+    bool next(QByteArray &feature);
+};
+
+bool GeoJsonScanner::next(QByteArray &feature)
+{
+    while (pos < size)
+    {
+        const char c = data[pos++];
+
+        if (c == '"')
+        {
+            const qint64 begin = pos;
+            while (pos < size && data[pos] != '"')
+                pos += data[pos] == '\\' ? 2 : 1;
+
+            if (depth == 1)
+                lastString = QByteArray(data + begin, static_cast<int>(pos - begin));
+
+            ++pos;
+            continue;
+        }
+
+        if (c == '{' || c == '[')
+        {
+            // only a key can be followed by an array in the root object
+            if (depth == 1 && c == '[' && lastString == "features")
+                inFeatures = hasFeatures = true;
+
+            if (inFeatures && depth == 2 && c == '{')
+                featureStart = pos - 1;
+
+            ++depth;
+        }
+        else if (c == '}' || c == ']')
+        {
+            --depth;
+
+            if (inFeatures && depth == 2 && featureStart >= 0)
+            {
+                feature = QByteArray::fromRawData(data + featureStart, static_cast<int>(pos - featureStart));
+                featureStart = -1;
+                return true;
+            }
+
+            if (depth <= 1)
+                inFeatures = false;
+        }
+    }
+
+    return false;
+}
+
+static inline QPointF toCoords(const QJsonValue &value)
+{
+    const QJsonArray array = value.toArray();
+    return QPointF(array.at(0).toDouble(), array.at(1).toDouble());
+}
+
+static QVector<QPointF> toCoordsList(const QJsonValue &value, bool isRing = false)
+{
+    const QJsonArray array = value.toArray();
+    QVector<QPointF> coords;
+    coords.reserve(array.size());
+
+    for (const QJsonValue &point: array)
+        coords.append(toCoords(point));
+
+    // rings repeat the first point, the path is closed anyway
+    if (isRing && coords.size() > 1 && coords.first() == coords.last())
+        coords.removeLast();
+
+    return coords;
+}
+
+static void appendGeometry(const QJsonObject &geometry, const QJsonObject &properties,
+                           QVector<ImportedFeature> &features)
+{
+    const QString type = geometry.value(QLatin1String("type")).toString();
+    const QJsonValue coordinates = geometry.value(QLatin1String("coordinates"));
+
+    ImportedFeature feature;
+    feature.properties = properties;
+
+    auto appendPart = [&](MapItemType partType, const QVector<QPointF> &coords, bool closed)
+    {
+        if (coords.isEmpty()) return;
+
+        feature.type = partType;
+        feature.coords = coords;
+        feature.closed = closed;
+        features.append(feature);
+    };
+
+    if (type == QLatin1String("Point"))
+    {
+        appendPart(MapItemType::DynamicItem, QVector<QPointF>() << toCoords(coordinates), false);
+    }
+    else if (type == QLatin1String("MultiPoint"))
+    {
+        for (const QJsonValue &point: coordinates.toArray())
+            appendPart(MapItemType::DynamicItem, QVector<QPointF>() << toCoords(point), false);
+    }
+    else if (type == QLatin1String("LineString"))
+    {
+        appendPart(MapItemType::StaticPath, toCoordsList(coordinates), false);
+    }
+    else if (type == QLatin1String("MultiLineString"))
+    {
+        for (const QJsonValue &line: coordinates.toArray())
+            appendPart(MapItemType::StaticPath, toCoordsList(line), false);
+    }
+    else if (type == QLatin1String("Polygon"))
+    {
+        appendPart(MapItemType::StaticPath, toCoordsList(coordinates.toArray().at(0), true), true);
+    }
+    else if (type == QLatin1String("MultiPolygon"))
+    {
+        for (const QJsonValue &polygon: coordinates.toArray())
+            appendPart(MapItemType::StaticPath, toCoordsList(polygon.toArray().at(0), true), true);
+    }
+    else if (type == QLatin1String("GeometryCollection"))
+    {
+        for (const QJsonValue &part: geometry.value(QLatin1String("geometries")).toArray())
+            appendGeometry(part.toObject(), properties, features);
+    }
+}
+
+static void parseFeature(const QByteArray &source, QVector<ImportedFeature> &features)
+{
+    const QJsonObject feature = QJsonDocument::fromJson(source).object();
+
+    appendGeometry(feature.value(QLatin1String("geometry")).toObject(),
+                   feature.value(QLatin1String("properties")).toObject(), features);
+}
+
+/*** MapImporter ***/
+
+struct MapImporter::MapImporterPrivate
+{
+    QPointer<MapView> view;
+    int batchSize = 2000;
+    QString binaryOutput;
+
+    QFile file;
+    uchar *data = Q_NULLPTR;
+    MapImportJob *job = Q_NULLPTR;
+    QFuture<void> future;
+    std::function<void(MapItem*, const QJsonObject&)> init;
+    CoordsTypes coordsType = Spherical;
+    int count = 0;
+};
+
+MapImporter::MapImporter(MapView *view, QObject *parent) : QObject(parent),
+    d(new MapImporterPrivate)
+{
+    d->view = view;
+}
+
+MapImporter::~MapImporter()
+{
+    cancel();
+    delete d;
+}
+
+void MapImporter::setBatchSize(int count)
+{
+    d->batchSize = qMax(1, count);
+}
+
+int MapImporter::batchSize() const
+{
+    return d->batchSize;
+}
+
+void MapImporter::setBinaryOutput(const QString &path)
+{
+    d->binaryOutput = path;
+}
+
+QString MapImporter::binaryOutput() const
+{
+    return d->binaryOutput;
+}
+
+bool MapImporter::start(const QString &path, const std::function<void(MapItem*, const QJsonObject&)> &init)
+{
+    if (d->job || !d->view) return false;
+
+    d->file.setFileName(path);
+    if (!d->file.open(QIODevice::ReadOnly)) return false;
+
+    d->data = d->file.size() > 0 ? d->file.map(0, d->file.size()) : Q_NULLPTR;
+
+    if (!d->data)
+    {
+        d->file.close();
+        return false;
+    }
+
+    d->init = init;
+    d->count = 0;
+    d->coordsType = MapGlobal::instance().coordsType();
+
+    d->job = new MapImportJob;
+    d->job->receiver = this;
+    d->job->data = reinterpret_cast<const char*>(d->data);
+    d->job->size = d->file.size();
+    d->job->isBinary = d->job->size >= BINARY_HEADER_SIZE &&
+            std::memcmp(d->job->data, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+    d->job->batchSize = d->batchSize;
+    d->job->coordsType = d->coordsType;
+    d->job->binaryOutput = d->job->isBinary ? QString() : d->binaryOutput;
+
+    d->future = QtConcurrent::run(&MapImporter::importTask, d->job);
+    return true;
+}
+
+void MapImporter::cancel()
+{
+    if (!d->job) return;
+
+    d->job->mutex.lock();
+    d->job->isCanceled.storeRelease(1);
+    d->job->drained.wakeAll();
+    d->job->mutex.unlock();
+
+    finishImport();
+}
+
+bool MapImporter::isRunning() const
+{
+    return d->job;
+}
+
+void MapImporter::onBatchReady()
+{
+    if (!d->job) return;
+
+    QVector<ImportBatch> batches;
+    bool isDone = false;
+
+    d->job->mutex.lock();
+    while (!d->job->batches.isEmpty())
+        batches.append(d->job->batches.dequeue());
+    isDone = d->job->isDone;
+    d->job->drained.wakeAll();
+    d->job->mutex.unlock();
+
+    const bool isProjected = d->coordsType == MapGlobal::instance().coordsType();
+
+    for (const ImportBatch &batch: qAsConst(batches))
+    {
+        // a slot of the signals below may cancel the import or delete the view
+        if (!d->job || !d->view) break;
+
+        const QVector<ImportedFeature> &features = batch.features;
+        const QVector<MapItem*> items = d->view->createItems(features.size(), [&](MapItem *item, int i)
+        {
+            const ImportedFeature &feature = features.at(i);
+
+            if (feature.type != MapItemType::DynamicItem)
+                item->setStaticGeometry(feature.type, feature.coords, feature.closed, feature.geometry);
+            else if (isProjected)
+                item->setPosition(feature.coords.first(), feature.point);
+            else item->move(feature.coords.first());
+
+            if (d->init) d->init(item, feature.properties);
+        });
+
+        d->count += items.size();
+        emit itemsImported(items);
+        emit progress(batch.bytesRead, d->file.size());
+    }
+
+    if (isDone && d->job)
+        finishImport();
+}
+
+void MapImporter::finishImport()
+{
+    d->future.waitForFinished();
+
+    const QString error = d->job->error;
+    const bool isCanceled = d->job->isCanceled.loadAcquire();
+
+    delete d->job;
+    d->job = Q_NULLPTR;
+
+    d->file.unmap(d->data);
+    d->file.close();
+    d->data = Q_NULLPTR;
+    d->init = Q_NULLPTR;
+    d->binaryOutput.clear();
+
+    if (isCanceled) return;
+
+    if (error.isEmpty())
+        emit finished(d->count);
+    else emit failed(error);
+}
+
+// runs in a worker thread, touches the importer only through the job
+void MapImporter::importTask(MapImportJob *job)
+{
+    QSaveFile output(job->binaryOutput);
+    const bool isWriting = !job->binaryOutput.isEmpty();
+
+    if (isWriting)
+    {
+        QByteArray header(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+        appendValue(header, BINARY_VERSION);
+
+        if (!output.open(QIODevice::WriteOnly) || output.write(header) != header.size())
+            job->error = QString("Can't write %1").arg(job->binaryOutput);
+    }
+
+    if (job->isBinary && readValue<quint32>(job->data + sizeof(BINARY_MAGIC)) != BINARY_VERSION)
+        job->error = QString("Unsupported binary version");
+
+    GeoJsonScanner scanner;
+    scanner.data = job->data;
+    scanner.size = job->size;
+    qint64 pos = BINARY_HEADER_SIZE;
+
+    while (job->error.isEmpty() && !job->isCanceled.loadAcquire())
+    {
+        QVector<ImportTask> tasks;
+        tasks.reserve(job->batchSize);
+
+        if (job->isBinary)
+        {
+            while (tasks.size() < job->batchSize && pos < job->size)
+            {
+                const qint64 size = recordSize(job->data + pos, job->size - pos);
+
+                if (size < 0)
+                {
+                    job->error = QString("Truncated record at %1").arg(pos);
+                    break;
+                }
+
+                ImportTask task;
+                task.source = QByteArray::fromRawData(job->data + pos, static_cast<int>(size));
+                tasks.append(task);
+                pos += size;
+            }
+        }
+        else
+        {
+            ImportTask task;
+            while (tasks.size() < job->batchSize && scanner.next(task.source))
+                tasks.append(task);
+
+            pos = scanner.pos;
+        }
+
+        if (tasks.isEmpty()) break;
+
+        const CoordsTypes coordsType = job->coordsType;
+        const bool isBinary = job->isBinary;
+
+        QtConcurrent::blockingMap(tasks, [=](ImportTask &task)
+        {
+            if (isBinary) readRecord(task.source, task.features);
+            else parseFeature(task.source, task.features);
+
+            for (ImportedFeature &feature: task.features)
+            {
+                if (isWriting)
+                    writeRecord(task.record, feature);
+
+                if (feature.type == MapItemType::DynamicItem)
+                {
+                    MapGlobal::instance().toPoints(feature.coords.constData(), &feature.point, 1, coordsType);
+                }
+                else
+                {
+                    feature.geometry = MapItem::projectGeometry(feature.type, feature.coords, feature.closed, coordsType);
+
+                    if (feature.type == MapItemType::StaticPath)
+                        feature.geometry.levels = MapItem::buildLevels(feature.geometry.path, feature.closed);
+                }
+            }
+        });
+
+        ImportBatch batch;
+        batch.bytesRead = pos;
+
+        for (const ImportTask &task: qAsConst(tasks))
+        {
+            batch.features += task.features;
+
+            if (isWriting && output.write(task.record) != task.record.size())
+                job->error = QString("Can't write %1").arg(job->binaryOutput);
+        }
+
+        job->mutex.lock();
+        while (job->batches.size() >= MAX_QUEUED_BATCHES && !job->isCanceled.loadAcquire())
+            job->drained.wait(&job->mutex);
+        job->batches.enqueue(batch);
+        job->mutex.unlock();
+
+        QMetaObject::invokeMethod(job->receiver, "onBatchReady", Qt::QueuedConnection);
+    }
+
+    if (job->error.isEmpty() && !job->isBinary && !scanner.hasFeatures)
+        job->error = QString("No FeatureCollection found");
+
+    // the binary file appears only after a complete import
+    if (isWriting && job->error.isEmpty() && !job->isCanceled.loadAcquire())
+        output.commit();
+    else output.cancelWriting();
+
+    job->mutex.lock();
+    job->isDone = true;
+    job->mutex.unlock();
+
+    QMetaObject::invokeMethod(job->receiver, "onBatchReady", Qt::QueuedConnection);
+}
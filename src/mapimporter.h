@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QJsonObject>
+#include <QObject>
+#include <functional>
+
+class MapView;
+class MapItem;
+
+//! \brief The MapImporter class, loads GeoJSON FeatureCollection files and
+//! its own binary format into MapView. The file is memory mapped and read on
+//! a worker thread, features are parsed and projected in parallel batches and
+//! the ready items are added by MapView::createItems() on the GUI thread.
+//! Point features become dynamic items, lines and polygon outer rings become
+//! static paths, multi geometries give an item per part.
+class MapImporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MapImporter(MapView *view, QObject *parent = Q_NULLPTR);
+    ~MapImporter();
+
+    void setBatchSize(int count); // features per batch handed to the view
+    int batchSize() const;
+
+    // a GeoJSON import also writes the features there, a binary file loads
+    // without text parsing, the path is cleared after each import
+    void setBinaryOutput(const QString &path);
+    QString binaryOutput() const;
+
+    // the format is detected by the file header, init(item, properties)
+    // styles each item before it is added to the scene
+    bool start(const QString &path, const std::function<void(MapItem*, const QJsonObject&)> &init = Q_NULLPTR);
+    void cancel();
+    bool isRunning() const;
+
+signals:
+    void progress(qint64 bytesRead, qint64 bytesTotal);
+    void itemsImported(const QVector<MapItem*> &items);
+    void finished(int count);
+    void failed(const QString &message);
+
+private slots:
+    void onBatchReady();
+
+private:
+    struct MapImportJob;
+    static void importTask(MapImportJob *job);
+    void finishImport();
+
+    struct MapImporterPrivate;
+    MapImporterPrivate * const d;
+};
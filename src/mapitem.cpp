@@ -1,13 +1,86 @@
 #include "mapitem.h"
 #include "mapglobal.h"
+#include "mapspatialindex.h"
+#include "mapclusterlayer.h"
+#include "maplabellayer.h"
+#include "mapoverlay.h"
 
 #include <QStyleOptionGraphicsItem>
 #include <QGraphicsSimpleTextItem>
-#include <QGraphicsPixmapItem>
+#include <QtConcurrentRun>
+#include <QFutureWatcher>
 #include <QPainter>
-#include <QBitmap>
-#include <QStyle>
 #include <QDebug>
+#include <QHash>
+#include <cmath>
+
+// paths with fewer points are painted as they are
+static const int LOD_MIN_POINTS = 256;
+// paths with more points get their levels built in a worker thread
+static const int LOD_ASYNC_POINTS = 8192;
+
+// Douglas-Peucker, keeps the points farther than tolerance from the simplified line
+static QVector<QPointF> simplify(const QVector<QPointF> &points, qreal tolerance)
+{
+    const int count = points.size();
+    if (count < 3) return points;
+
+    const qreal tolerance2 = tolerance * tolerance;
+    QVector<bool> keep(count, false);
+    keep[0] = true;
+    keep[count - 1] = true;
+
+    QVector<QPair<int, int>> ranges;
+    ranges.append(qMakePair(0, count - 1));
+
+    while (!ranges.isEmpty())
+    {
+        const QPair<int, int> range = ranges.takeLast();
+        const QPointF &a = points.at(range.first);
+        const QPointF ab = points.at(range.second) - a;
+        const qreal length2 = QPointF::dotProduct(ab, ab);
+
+        int index = -1;
+        qreal maxDistance2 = tolerance2;
+
+        for (int i=range.first + 1; i<range.second; ++i)
+        {
+            const QPointF ap = points.at(i) - a;
+            const qreal t = length2 > 0. ? qBound(0., QPointF::dotProduct(ap, ab) / length2, 1.) : 0.;
+            const QPointF delta = ap - t * ab;
+            const qreal distance2 = QPointF::dotProduct(delta, delta);
+
+            if (distance2 > maxDistance2)
+            {
+                maxDistance2 = distance2;
+                index = i;
+            }
+        }
+
+        if (index < 0) continue;
+
+        keep[index] = true;
+        ranges.append(qMakePair(range.first, index));
+        ranges.append(qMakePair(index, range.second));
+    }
+
+    QVector<QPointF> result;
+    for (int i=0; i<count; ++i)
+        if (keep.at(i)) result.append(points.at(i));
+
+    return result;
+}
+
+// factor is a power of two, one pixel covers 2^level scene units
+static const QPainterPath &levelPath(const QPainterPath &path, const QVector<QPainterPath> &levels, qreal factor)
+{
+    if (levels.isEmpty()) return path;
+
+    const int level = qMin(std::ilogb(factor), levels.size());
+    if (level <= 0) return path;
+
+    return levels.at(level - 1);
+}
 
 struct MapItem::MapItemPrivate
 {
@@ -25,40 +98,65 @@ struct MapItem::MapItemPrivate
     bool isPressed = false;
     bool isHovered = false;
     bool isSelected = false;
+    bool isBatch = false; // the caller updates the index and the layers
 
-    QFont   font = QFont("mono", 12, QFont::Medium);
-    QColor  color = QColor(Qt::black);
     MapItemType type = MapItemType::DynamicItem;
     QPointF textIndent = {0., 0.};
+    int textPriority = 0;
 
-    QMap<MapItemState, QPen>   pens;
-    QMap<MapItemState, QBrush> brushes;
+    MapStyle style;
+    int styleHandle = -1;
 
     QPainterPath path;
     QVector<QPointF> coords;
+
+    // projected geometry per CoordsTypes, a provider switch back and forth
+    // reuses it instead of projecting every point again
+    CoordsTypes coordsType = Spherical;
+    QHash<int, MapItemGeometry> geometries;
+    quint64 version = 0;
+
+    QVector<QPainterPath> levels;
+    QFutureWatcher<QVector<QPainterPath>> *levelsWatcher = Q_NULLPTR;
+    CoordsTypes levelsType = Spherical;
+    quint64 levelsVersion = 0;
+
+    MapSpatialIndex *index = Q_NULLPTR;
+    MapClusterLayer *clusterLayer = Q_NULLPTR;
+    MapLabelLayer *labelLayer = Q_NULLPTR;
+    MapOverlay *overlay = Q_NULLPTR;
+    int hiddenFlags = 0;
 };
 
 MapItem::MapItem(QGraphicsItem *parent) : QGraphicsObject(parent),
     d(new MapItemPrivate)
 {
-    d->pens = { {MapItemState::Default,    QPen(QBrush(QColor(Qt::black)), 1)},
-                {MapItemState::Hovered,    QPen(QBrush(QColor(Qt::black)), 1)},
-                {MapItemState::Selected,   QPen(QBrush(QColor(Qt::black)), 1)} };
-
-    d->brushes = { {MapItemState::Default,     QBrush(QColor(0, 0, 0, 0))},
-                   {MapItemState::Hovered,     QBrush(QColor(0, 0, 0, 0))},
-                   {MapItemState::Selected,    QBrush(QColor(0, 0, 0, 0))} };
-
     d->coords.append(QPointF(0., 0.));
 
     setZValue(1);
     setAcceptHoverEvents(true);
     setCacheMode(DeviceCoordinateCache);
     setFlag(ItemSendsGeometryChanges, true);
+    setFlag(ItemIgnoresTransformations, true);
 }
 
 MapItem::~MapItem()
 {
+    if (d->index)
+        d->index->remove(this);
+
+    if (d->clusterLayer)
+        d->clusterLayer->removeItem(this);
+
+    if (d->labelLayer)
+        d->labelLayer->removeItem(this);
+
+    if (d->overlay)
+        d->overlay->removeItem(this);
+
+    if (d->styleHandle >= 0)
+        MapStyleRegistry::instance().detach(d->styleHandle, this);
+
     if(d->itemPixmap)
         delete d->itemPixmap;
 
@@ -74,6 +172,16 @@ void MapItem::move(const QPointF &coords)
     setPos(d->settings.toPoint(coords));
 }
 
+// position projected by the caller; a batch leaves the index and the layers
+// to the caller, which updates them once for all moved items
+void MapItem::setPosition(const QPointF &coords, const QPointF &point, bool isBatch)
+{
+    d->coords[0] = coords;
+    d->isBatch = isBatch;
+    setPos(point);
+    d->isBatch = false;
+}
+
 QPointF MapItem::coords()
 {
     return d->settings.toCoords(pos());
@@ -100,9 +208,6 @@ void MapItem::setSelectable(bool state)
 void MapItem::setSelected(bool state)
 {
     QGraphicsObject::setSelected(state);
-
-    if (d->itemPixmap)
-        d->itemPixmap->setSelected(state);
 }
 
 void MapItem::setMovable(bool state)
@@ -119,80 +224,80 @@ void MapItem::setMovable(bool state)
 
 void MapItem::setPen(const QPen &pen, MapItemState state)
 {
-    if (state == MapItemState::AllState)
-    {
-        d->pens[MapItemState::Default] = pen;
-        d->pens[MapItemState::Hovered] = pen;
-        d->pens[MapItemState::Selected] = pen;
-    }
-    else d->pens[state] = pen;
-
-    if (d->itemPath)
-        d->itemPath->setPen(pen, state);
+    setStyle(d->style.withPen(pen, state));
 }
 
 void MapItem::setBrush(const QBrush &brush, MapItemState state)
 {
-    if (state == MapItemState::AllState)
-    {
-        d->brushes[MapItemState::Default] = brush;
-        d->brushes[MapItemState::Hovered] = brush;
-        d->brushes[MapItemState::Selected] = brush;
-    }
-    else d->brushes[state] = brush;
+    setStyle(d->style.withBrush(brush, state));
+}
 
+void MapItem::setFont(const QFont &font)
+{
+    setStyle(d->style.withFont(font));
+}
 
-    if (d->itemPath)
-        d->itemPath->setBrush(brush ,state);
+void MapItem::setColor(const QColor &color)
+{
+    setStyle(d->style.withColor(color));
 }
 
-void MapItem::setFont(const QFont &font)
+void MapItem::setMaskBrush(const QBrush &brush, MapItemState state)
 {
-    d->font = font;
+    setStyle(d->style.withMaskBrush(brush, state));
+}
 
-    if(d->itemText)
-    {
-        d->itemText->setFont(font);
-        d->itemText->update(d->itemText->boundingRect());
-    }
+void MapItem::setStyle(const MapStyle &style)
+{
+    if (d->styleHandle >= 0)
+        MapStyleRegistry::instance().detach(d->styleHandle, this);
+
+    d->styleHandle = -1;
+    applyStyle(style);
 }
 
-void MapItem::setColor(const QColor &color)
+void MapItem::setStyle(int handle)
 {
-    d->color = color;
+    MapStyleRegistry &registry = MapStyleRegistry::instance();
+    if (!registry.contains(handle) || handle == d->styleHandle) return;
 
-    if(d->itemText)
-        d->itemText->setBrush(QBrush(color));
+    if (d->styleHandle >= 0)
+        registry.detach(d->styleHandle, this);
+
+    d->styleHandle = handle;
+    registry.attach(handle, this);
+    applyStyle(registry.style(handle));
 }
 
-void MapItem::setMaskBrush(const QBrush &brush, MapItemState state)
+MapStyle MapItem::style() const
 {
-    if(d->itemPixmap)
-        d->itemPixmap->setMaskBrush(brush, state);
+    return d->style;
 }
 
-void MapItem::setPixmap(const QPixmap &pixmap, const QSize &size, MapItemState state)
+int MapItem::styleHandle() const
 {
-    QPixmap pix(size);
-    pix.fill(QColor(0, 0, 0, 0));
+    return d->styleHandle;
+}
 
-    QPainter painter(&pix);
-    painter.setRenderHint(QPainter::SmoothPixmapTransform);
-    painter.drawPixmap(pix.rect(), pixmap, pixmap.rect());
-    painter.end();
+void MapItem::setPixmap(const QPixmap &pixmap, const QSize &size, MapItemState state)
+{
+    const MapIcon icon = MapIconAtlas::instance().icon(pixmap, size);
+    if (icon.isNull()) return;
 
     if (!d->itemPixmap)
     {
-        d->itemPixmap = new MapItemPixmap(pix, this);
-        d->itemPixmap->setItemPixmap(pix, state);
+        d->itemPixmap = new MapItemPixmap(icon, this);
+        d->itemPixmap->setIcon(icon, state);
         d->itemPixmap->setFlag(QGraphicsItem::ItemIsSelectable, d->isSelectable);
         d->itemPixmap->setFlag(QGraphicsItem::ItemIsMovable, d->isMovable);
         d->itemPixmap->setTransformOriginPoint(d->itemPixmap->boundingRect().center());
-        d->itemPixmap->setTransformationMode(Qt::SmoothTransformation);
         d->itemPixmap->setPos(-d->itemPixmap->boundingRect().center().x(),
                               -d->itemPixmap->boundingRect().center().y());
+
+        if (d->index)
+            d->index->update(this);
     }
-    else d->itemPixmap->setItemPixmap(pix, state);
+    else d->itemPixmap->setIcon(icon, state);
 }
 
 void MapItem::setText(const QString &text, const QPoint &indent)
@@ -200,19 +305,24 @@ void MapItem::setText(const QString &text, const QPoint &indent)
     if (!d->itemText)
     {
         d->itemText = new QGraphicsSimpleTextItem(text, this);
-        d->itemText->setFont(d->font);
-        d->itemText->setBrush(QBrush(d->color));
-        d->itemText->setTransformOriginPoint(d->itemText->boundingRect().center());
+        d->itemText->setFont(d->style.font());
+        d->itemText->setBrush(QBrush(d->style.color(state())));
     }
     else d->itemText->setText(text);
 
-    QPointF pathIndent(0., 0.);
-    if (!d->path.isEmpty())
-        pathIndent = d->path.boundingRect().center();
-
     d->textIndent = indent;
-    d->itemText->setPos(-d->itemText->boundingRect().center()
-                        + static_cast<QPointF>(d->textIndent) + pathIndent);
+    updateTextPos();
+
+    if (d->labelLayer)
+        d->labelLayer->updateItem(this);
+}
+
+void MapItem::setTextPriority(int priority)
+{
+    d->textPriority = priority;
+
+    if (d->labelLayer)
+        d->labelLayer->updateItem(this);
 }
 
 void MapItem::setPath(const QPainterPath &path)
@@ -225,6 +335,9 @@ void MapItem::setPath(const QPainterPath &path)
     d->itemPath->setTransformOriginPoint(d->itemPath->boundingRect().center());
     d->itemPath->setPos(-d->itemPath->boundingRect().center().x(),
                         -d->itemPath->boundingRect().center().y());
+
+    if (d->index)
+        d->index->update(this);
 }
 
 void MapItem::setRect(const QSize &size, const QSize &radius)
@@ -245,36 +358,16 @@ void MapItem::setEllipse(const QSize &size)
 
 void MapItem::setStaticPath(const QVector<QPointF> &points, bool close)
 {
-    prepareGeometryChange();
     d->isStatic = true;
     d->type = MapItemType::StaticPath;
-
-#if QT_VERSION >= 0x051300
-    d->path.clear();
-#else
-    d->path = QPainterPath();
-#endif
-
     d->coords = points;
     d->isClosed = close;
 
-    for (int i=0; i<points.size(); ++i)
-    {
-        const QPointF &coords = points.at(i);
-        QPointF &&point = d->settings.toPoint(coords);
-
-        if (i == 0) d->path.moveTo(point);
-        else d->path.lineTo(point);
-    }
-
-    if (close) d->path.closeSubpath();
-
-    update(d->path.boundingRect());
+    resetGeometry();
 }
 
 void MapItem::setStaticRect(const QPointF &boundLeftTop, const QPointF &boundRightBottom)
 {
-    prepareGeometryChange();
     d->isStatic = true;
     d->type = MapItemType::StaticRect;
 
@@ -282,22 +375,11 @@ void MapItem::setStaticRect(const QPointF &boundLeftTop, const QPointF &boundRig
     d->coords.append(boundLeftTop);
     d->coords.append(boundRightBottom);
 
-    QRectF rect = QRectF(d->settings.toPoint(boundLeftTop),
-                         d->settings.toPoint(boundRightBottom));
-
-#if QT_VERSION >= 0x051300
-    d->path.clear();
-#else
-    d->path = QPainterPath();
-#endif
-
-    d->path.addRect(rect);
-    update(d->path.boundingRect());
+    resetGeometry();
 }
 
 void MapItem::setStaticEllipse(const QPointF &boundLeftTop, const QPointF &boundRightBottom)
 {
-    prepareGeometryChange();
     d->isStatic = true;
     d->type = MapItemType::StaticEllipse;
 
@@ -305,17 +387,7 @@ void MapItem::setStaticEllipse(const QPointF &boundLeftTop, const QPointF &bound
     d->coords.append(boundLeftTop);
     d->coords.append(boundRightBottom);
 
-    QRectF rect = QRectF(d->settings.toPoint(boundLeftTop),
-                         d->settings.toPoint(boundRightBottom));
-
-#if QT_VERSION >= 0x051300
-    d->path.clear();
-#else
-    d->path = QPainterPath();
-#endif
-
-    d->path.addEllipse(rect);
-    update(d->path.boundingRect());
+    resetGeometry();
 }
 
 QVector<QPointF> MapItem::coordsList()
@@ -335,12 +407,17 @@ bool MapItem::isInMove()
 
 QFont MapItem::font()
 {
-    QFont font;
+    return d->style.font();
+}
 
-    if (d->itemText)
-        font = d->itemText->font();
+QString MapItem::text() const
+{
+    return d->itemText ? d->itemText->text() : QString();
+}
 
-    return font;
+int MapItem::textPriority() const
+{
+    return d->textPriority;
 }
 
 void MapItem::updateCoords()
@@ -348,28 +425,337 @@ void MapItem::updateCoords()
     if (d->coords.isEmpty()) return;
 
     if (d->type == MapItemType::DynamicItem)
+    {
         move(d->coords.at(0));
-    else if (d->type == MapItemType::StaticPath)
-        setStaticPath(d->coords, d->isClosed);
-    else if (d->type == MapItemType::StaticRect)
-        setStaticRect(d->coords.at(0), d->coords.at(1));
-    else if (d->type == MapItemType::StaticEllipse)
-        setStaticEllipse(d->coords.at(0), d->coords.at(1));
+        return;
+    }
 
-    if (d->itemText && !d->path.isEmpty())
-    {
-        QPointF pathIndent(0., 0.);
+    const CoordsTypes coordsType = d->settings.coordsType();
+    if (coordsType == d->coordsType) return;
+
+    if (hasGeometry(coordsType))
+        applyGeometry(d->geometries.value(coordsType));
+    else applyGeometry(projectGeometry(d->type, d->coords, d->isClosed, coordsType));
+}
+
+void MapItem::updateTextPos()
+{
+    if (!d->itemText) return;
+
+    QPointF pathIndent(0., 0.);
+    if (!d->path.isEmpty())
         pathIndent = d->path.boundingRect().center();
-        d->itemText->setPos(-d->itemText->boundingRect().center()
-                            + static_cast<QPointF>(d->textIndent) + pathIndent);
+
+    // the text keeps its size in pixels and is centered on the anchor
+    const QPointF center = d->itemText->boundingRect().center();
+    d->itemText->setFlag(QGraphicsItem::ItemIgnoresTransformations, !d->path.isEmpty());
+    d->itemText->setTransform(QTransform::fromTranslate(-center.x(), -center.y()));
+    d->itemText->setPos(d->textIndent + pathIndent);
+
+    updateFactor();
+}
+
+void MapItem::updateTextColor()
+{
+    if (d->itemText)
+        d->itemText->setBrush(QBrush(d->style.color(state())));
+
+    if (d->labelLayer)
+        d->labelLayer->update();
+}
+
+// paint() only reads the state, the parts drawn per state are repainted here
+void MapItem::updateState()
+{
+    updateTextColor();
+    update();
+
+    if (d->itemPixmap)
+        d->itemPixmap->update();
+
+    if (d->itemPath)
+        d->itemPath->update();
+}
+
+// one call per restyle, whatever changed in the style
+// only the pen width and the font change the geometry, other changes are a
+// repaint; update() stays per item, it drops the device cache of the item
+void MapItem::applyStyle(const MapStyle &style)
+{
+    const bool isGeometryChanged = d->style.pen().widthF() != style.pen().widthF() ||
+                                   d->style.font() != style.font();
+
+    if (isGeometryChanged)
+        prepareGeometryChange();
+
+    d->style = style;
+
+    if (d->itemText)
+    {
+        if (isGeometryChanged)
+        {
+            d->itemText->setFont(style.font());
+            updateTextPos();
+        }
+
+        updateTextColor();
+    }
+
+    if (d->itemPixmap)
+        d->itemPixmap->update();
+
+    if (d->itemPath)
+        d->itemPath->update();
+
+    update();
+
+    if (isGeometryChanged)
+    {
+        if (d->index)
+            d->index->update(this);
+
+        if (d->labelLayer)
+            d->labelLayer->updateItem(this);
+    }
+
+    // tiles are drawn with the pen and the brush
+    if (d->overlay)
+        d->overlay->updateItem(this);
+}
+
+MapItemState MapItem::state() const
+{
+    if (d->isSelected) return MapItemState::Selected;
+    if (d->isHovered) return MapItemState::Hovered;
+
+    return MapItemState::Default;
+}
+
+void MapItem::resetGeometry()
+{
+    ++d->version;
+    d->geometries.clear();
+    applyGeometry(projectGeometry(d->type, d->coords, d->isClosed, d->settings.coordsType()));
+}
+
+void MapItem::applyGeometry(const MapItemGeometry &geometry)
+{
+    prepareGeometryChange();
+
+    d->geometries.insert(geometry.coordsType, geometry);
+    d->coordsType = geometry.coordsType;
+    d->path = geometry.path;
+    d->levels = geometry.levels;
+
+    // static items scale with the map, dynamic ones keep their size in pixels
+    setFlag(ItemIgnoresTransformations, d->path.isEmpty());
+
+    if (d->levels.isEmpty())
+        updateLevels();
+
+    setPos(geometry.origin);
+    updateTextPos();
+    update(d->path.boundingRect());
+
+    if (d->index)
+        d->index->update(this);
+
+    if (d->clusterLayer)
+        d->clusterLayer->updateItem(this);
+
+    if (d->labelLayer)
+        d->labelLayer->updateItem(this);
+
+    if (d->overlay)
+        d->overlay->updateItem(this);
+}
+
+void MapItem::insertGeometry(const MapItemGeometry &geometry, quint64 version)
+{
+    if (version != d->version) return;
+
+    if (geometry.coordsType == d->settings.coordsType())
+        applyGeometry(geometry);
+    else d->geometries.insert(geometry.coordsType, geometry);
+}
+
+// geometry projected in advance, MapImporter prepares it in worker threads
+void MapItem::setStaticGeometry(MapItemType type, const QVector<QPointF> &coords, bool closed,
+                                const MapItemGeometry &geometry)
+{
+    d->isStatic = true;
+    d->type = type;
+    d->coords = coords;
+    d->isClosed = closed;
+
+    if (geometry.coordsType != d->settings.coordsType())
+    {
+        resetGeometry();
+        return;
+    }
+
+    ++d->version;
+    d->geometries.clear();
+    applyGeometry(geometry);
+}
+
+bool MapItem::hasGeometry(CoordsTypes type) const
+{
+    return d->geometries.contains(type);
+}
+
+quint64 MapItem::geometryVersion() const
+{
+    return d->version;
+}
+
+// touches no item state, MapView runs it in worker threads
+MapItemGeometry MapItem::projectGeometry(MapItemType type, const QVector<QPointF> &coords,
+                                         bool closed, CoordsTypes coordsType)
+{
+    MapItemGeometry geometry;
+    geometry.coordsType = coordsType;
+
+    if (type == MapItemType::StaticPath)
+    {
+        QVector<QPointF> points(coords.size());
+        MapGlobal::instance().toPoints(coords.constData(), points.data(), coords.size(), coordsType);
+
+#if QT_VERSION >= 0x051300
+        geometry.path.reserve(points.size());
+#endif
+
+        // the path is relative to the item position, so it holds small
+        // values that stay precise however far the scene extends
+        geometry.origin = points.isEmpty() ? QPointF() : points.first();
+
+        for (int i=0; i<points.size(); ++i)
+        {
+            const QPointF point = points.at(i) - geometry.origin;
+
+            if (i == 0) geometry.path.moveTo(point);
+            else geometry.path.lineTo(point);
+        }
+
+        if (closed) geometry.path.closeSubpath();
+    }
+    else if (type != MapItemType::DynamicItem && coords.size() >= 2)
+    {
+        QPointF points[2];
+        MapGlobal::instance().toPoints(coords.constData(), points, 2, coordsType);
+
+        QRectF rect(points[0], points[1]);
+        geometry.origin = rect.center();
+        rect.translate(-geometry.origin);
+
+        if (type == MapItemType::StaticRect)
+            geometry.path.addRect(rect);
+        else geometry.path.addEllipse(rect);
+    }
+
+    return geometry;
+}
+
+void MapItem::updateLevels()
+{
+    if (d->type != MapItemType::StaticPath || d->path.elementCount() < LOD_MIN_POINTS) return;
+
+    if (d->path.elementCount() < LOD_ASYNC_POINTS)
+    {
+        d->levels = buildLevels(d->path, d->isClosed);
+        d->geometries[d->coordsType].levels = d->levels;
+        return;
+    }
+
+    if (!d->levelsWatcher)
+    {
+        d->levelsWatcher = new QFutureWatcher<QVector<QPainterPath>>(this);
+        connect(d->levelsWatcher, &QFutureWatcher<QVector<QPainterPath>>::finished, this, &MapItem::onLevelsReady);
+    }
+
+    d->levelsType = d->coordsType;
+    d->levelsVersion = d->version;
+    d->levelsWatcher->setFuture(QtConcurrent::run(&MapItem::buildLevels, d->path, d->isClosed));
+}
+
+void MapItem::waitForLevels()
+{
+    if (!d->levelsWatcher || d->levelsWatcher->isFinished()) return;
+
+    // apply the levels now, the queued finished signal only reapplies them
+    d->levelsWatcher->waitForFinished();
+    onLevelsReady();
+}
+
+void MapItem::onLevelsReady()
+{
+    if (d->levelsVersion != d->version || !d->geometries.contains(d->levelsType)) return;
+
+    const QVector<QPainterPath> levels = d->levelsWatcher->result();
+    d->geometries[d->levelsType].levels = levels;
+
+    if (d->levelsType == d->coordsType)
+    {
+        d->levels = levels;
+        update();
     }
 }
 
+const QPainterPath &MapItem::currentPath() const
+{
+    return currentPath(d->settings.factor());
+}
+
+const QPainterPath &MapItem::currentPath(qreal factor) const
+{
+    return levelPath(d->path, d->levels, factor);
+}
+
+// level k is simplified from level k - 1 with tolerance 2^k / 4, so the
+// accumulated error stays under half a pixel at factor 2^k
+QVector<QPainterPath> MapItem::buildLevels(const QPainterPath &path, bool closed)
+{
+    QVector<QPainterPath> levels;
+    if (path.elementCount() < LOD_MIN_POINTS) return levels;
+
+    QVector<QPointF> points(path.elementCount());
+    for (int i=0; i<points.size(); ++i)
+        points[i] = path.elementAt(i);
+
+    qreal tolerance = 0.5;
+
+    while (points.size() > 2 && levels.size() < MapGlobal::instance().zoomMax())
+    {
+        const int count = points.size();
+        points = simplify(points, tolerance);
+        tolerance *= 2.;
+
+        if (points.size() == count && !levels.isEmpty())
+        {
+            levels.append(levels.last());
+            continue;
+        }
+
+        QPainterPath level;
+#if QT_VERSION >= 0x051300
+        level.reserve(points.size());
+#endif
+        level.moveTo(points.first());
+        for (int i=1; i<points.size(); ++i)
+            level.lineTo(points.at(i));
+
+        if (closed) level.closeSubpath();
+        levels.append(level);
+    }
+
+    return levels;
+}
+
 QRectF MapItem::boundingRect() const
 {
     if (!d->path.isEmpty())
     {
-        qreal penWidth = d->pens[MapItemState::Default].widthF();
+        qreal penWidth = d->style.pen().widthF();
         return d->path.boundingRect().adjusted(-penWidth, -penWidth,
                                                penWidth, penWidth);
     }
@@ -381,8 +767,8 @@ QRectF MapItem::boundingRect() const
 
 QPainterPath MapItem::shape() const
 {
-    if (!d->path.isEmpty() && d->isSelectable)
-        return d->path;
+    if (!d->path.isEmpty() && d->isSelectable && !d->hiddenFlags)
+        return currentPath();
     else return QPainterPath();
 }
 
@@ -391,24 +777,17 @@ void MapItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWi
     Q_UNUSED(item);
     Q_UNUSED(widget);
 
-    checkScale();
+    if (d->path.isEmpty() || d->hiddenFlags) return;
 
-    if (d->path.isEmpty()) return;
+    const MapItemState state = this->state();
 
-    bool isHovered = item->state & QStyle::State_MouseOver;
-    bool isSelected = item->state & QStyle::State_Selected;
-
-    MapItemState state = MapItemState::Default;
-    if (isSelected) state = MapItemState::Selected;
-    else if(isHovered) state = MapItemState::Hovered;
-
-    QPen pen = d->pens[state];
-    pen.setWidthF(pen.widthF() * d->settings.factor());
+    QPen pen = d->style.pen(state);
+    pen.setCosmetic(true);
 
     painter->setRenderHint(QPainter::Antialiasing);
     painter->setPen(pen);
-    painter->setBrush(d->brushes[state]);
-    painter->drawPath(d->path);
+    painter->setBrush(d->style.brush(state));
+    painter->drawPath(currentPath());
 }
 
 QVariant MapItem::itemChange(QGraphicsItem::GraphicsItemChange change, const QVariant &value)
@@ -421,31 +800,359 @@ QVariant MapItem::itemChange(QGraphicsItem::GraphicsItemChange change, const QVa
             emit moved(d->settings.toCoords(value.toPointF()));
         }
     }
+    else if (change == ItemPositionHasChanged && !d->isBatch)
+    {
+        if (d->index)
+            d->index->update(this);
+
+        if (d->clusterLayer)
+            d->clusterLayer->updateItem(this);
+
+        if (d->labelLayer)
+            d->labelLayer->updateItem(this);
+
+        if (d->overlay)
+            d->overlay->updateItem(this);
+    }
+    else if (change == ItemVisibleHasChanged)
+    {
+        // culled, clustered or rasterized items keep their visibility, only
+        // setVisible() of the user gets here, through any base class
+        if (d->clusterLayer)
+            d->clusterLayer->updateItem(this);
+
+        if (d->labelLayer)
+            d->labelLayer->updateItem(this);
+
+        if (d->overlay)
+            d->overlay->updateItem(this);
+    }
+    else if (change == ItemSelectedHasChanged)
+    {
+        // the pixmap and the path are selected together with the item
+        const bool state = value.toBool();
+
+        if (d->itemPixmap)
+            d->itemPixmap->setSelected(state);
+
+        if (d->itemPath)
+            d->itemPath->setSelected(state);
+
+        onSelectEvent(state);
+    }
 
     return QGraphicsItem::itemChange(change, value);
 }
 
-void MapItem::checkScale()
+void MapItem::hoverEnterEvent(QGraphicsSceneHoverEvent *event)
 {
-    if (d->path.isEmpty())
+    QGraphicsObject::hoverEnterEvent(event);
+    onHoverEvent(true);
+}
+
+void MapItem::hoverLeaveEvent(QGraphicsSceneHoverEvent *event)
+{
+    QGraphicsObject::hoverLeaveEvent(event);
+    onHoverEvent(false);
+}
+
+// called once per zoom change, paint() does not change the item
+void MapItem::updateFactor()
+{
+    if (!d->itemText) return;
+
+    if (d->labelLayer || d->hiddenFlags)
+        d->itemText->hide();
+    else if (!d->path.isEmpty())
+        d->itemText->setVisible(d->itemText->boundingRect().width() <= textWidthLimit());
+    else d->itemText->show();
+}
+
+// copies what MapRenderer paints. Geometry of other projections is taken
+// from the item when it has it, otherwise projectSnapshot() projects it.
+MapItemSnapshot MapItem::snapshot(CoordsTypes coordsType, qreal factor) const
+{
+    const MapItemState state = this->state();
+
+    MapItemSnapshot snapshot;
+    snapshot.type = d->type;
+    snapshot.isClosed = d->isClosed;
+    snapshot.zValue = zValue();
+    snapshot.pen = d->style.pen(state);
+    snapshot.brush = d->style.brush(state);
+
+    QRectF rect;
+    indexGeometry(rect, snapshot.margin);
+
+    if (d->type == MapItemType::DynamicItem)
+    {
+        snapshot.coords.append(d->settings.toCoords(pos()));
+
+        if (coordsType == d->settings.coordsType())
+        {
+            snapshot.origin = pos();
+            snapshot.isProjected = true;
+        }
+    }
+    else if (coordsType == d->coordsType)
     {
-        if (scale() != d->settings.factor())
-            setScale(d->settings.factor());
+        snapshot.origin = pos();
+        snapshot.path = currentPath(factor);
+        snapshot.isProjected = true;
     }
-    else
+    else if (hasGeometry(coordsType))
     {
-        if (d->itemText)
-        {
-            if (d->itemText->scale() != d->settings.factor())
-                d->itemText->setScale(d->settings.factor());
+        const MapItemGeometry &geometry = d->geometries.constFind(coordsType).value();
+        snapshot.origin = geometry.origin;
+        snapshot.path = levelPath(geometry.path, geometry.levels, factor);
+        snapshot.isProjected = true;
+    }
+    else snapshot.coords = d->coords;
 
-            const qreal pathWidth = d->path.boundingRect().width() / d->settings.factor();
-            const qreal textWidth = d->itemText->boundingRect().width();
+    if (d->itemPath)
+    {
+        snapshot.shape = d->itemPath->shape();
+        snapshot.shapeTransform = d->itemPath->itemTransform(this);
+    }
 
-            if (textWidth > pathWidth) d->itemText->hide();
-            else d->itemText->show();
+    if (d->itemPixmap)
+    {
+        const MapIcon *icons = d->itemPixmap->d->icons;
+        const MapIcon &defaultIcon = icons[static_cast<int>(MapItemState::Default)];
+        const MapIcon &stateIcon = icons[static_cast<int>(state)];
+        const MapIcon &icon = stateIcon.isNull() ? defaultIcon : stateIcon;
+        const MapIconAtlas &atlas = d->itemPixmap->d->atlas;
+
+        snapshot.icon = atlas.pageImage(icon.page);
+        snapshot.iconSource = icon.rect;
+        snapshot.iconRect = d->itemPixmap->boundingRect();
+        snapshot.iconTransform = d->itemPixmap->itemTransform(this);
+
+        if (state != MapItemState::Default && d->style.maskBrush(state) != Qt::NoBrush)
+        {
+            snapshot.iconMask = atlas.pageImage(defaultIcon.page).copy(defaultIcon.rect);
+
+            QPainter maskPainter(&snapshot.iconMask);
+            maskPainter.setCompositionMode(QPainter::CompositionMode_SourceIn);
+            maskPainter.fillRect(snapshot.iconMask.rect(), d->style.maskBrush(state));
+            maskPainter.end();
         }
     }
+
+    if (d->itemText && !d->itemText->text().isEmpty())
+    {
+        snapshot.text = d->itemText->text();
+        snapshot.textRect = d->itemText->boundingRect();
+        snapshot.font = d->style.font();
+        snapshot.textColor = d->style.color(state);
+        snapshot.textIndent = d->textIndent;
+    }
+
+    // paths cache their bounds on first use, the copies shared with the item
+    // are only read by the workers
+    snapshot.path.boundingRect();
+    snapshot.path.controlPointRect();
+    snapshot.shape.controlPointRect();
+
+    return snapshot;
+}
+
+// called by the workers, the geometry is projected without levels of detail
+void MapItem::projectSnapshot(MapItemSnapshot &snapshot, CoordsTypes coordsType)
+{
+    if (snapshot.isProjected) return;
+
+    if (snapshot.type == MapItemType::DynamicItem)
+    {
+        MapGlobal::instance().toPoints(snapshot.coords.constData(), &snapshot.origin, 1, coordsType);
+    }
+    else
+    {
+        const MapItemGeometry geometry = projectGeometry(snapshot.type, snapshot.coords, snapshot.isClosed, coordsType);
+        snapshot.origin = geometry.origin;
+        snapshot.path = geometry.path;
+    }
+
+    snapshot.isProjected = true;
+}
+
+// paints the snapshot with the painter origin at its position in pixels
+void MapItem::render(QPainter *painter, const MapItemSnapshot &snapshot, qreal factor)
+{
+    const qreal scale = snapshot.path.isEmpty() ? 1. : 1. / factor; // static items scale with the map
+
+    if (!snapshot.path.isEmpty())
+    {
+        QPen pen = snapshot.pen;
+        pen.setCosmetic(true);
+
+        painter->save();
+        painter->scale(scale, scale);
+        painter->setPen(pen);
+        painter->setBrush(snapshot.brush);
+        painter->drawPath(snapshot.path);
+        painter->restore();
+    }
+
+    if (!snapshot.shape.isEmpty())
+    {
+        painter->save();
+        painter->scale(scale, scale);
+        painter->setTransform(snapshot.shapeTransform, true);
+        painter->setPen(snapshot.pen);
+        painter->setBrush(snapshot.brush);
+        painter->drawPath(snapshot.shape);
+        painter->restore();
+    }
+
+    if (!snapshot.icon.isNull())
+    {
+        painter->save();
+        painter->scale(scale, scale);
+        painter->setTransform(snapshot.iconTransform, true);
+        painter->setRenderHint(QPainter::SmoothPixmapTransform);
+        painter->drawImage(snapshot.iconRect, snapshot.icon, snapshot.iconSource);
+
+        if (!snapshot.iconMask.isNull())
+            painter->drawImage(snapshot.iconRect, snapshot.iconMask);
+
+        painter->restore();
+    }
+
+    if (snapshot.text.isEmpty()) return;
+
+    // the text is centered on its anchor and keeps its size in pixels
+    QPointF center = snapshot.textIndent;
+
+    if (!snapshot.path.isEmpty())
+    {
+        const QRectF pathRect = snapshot.path.boundingRect();
+        if (snapshot.textRect.width() > pathRect.width() / factor) return;
+        center = (pathRect.center() + snapshot.textIndent) / factor;
+    }
+
+    painter->setFont(snapshot.font);
+    painter->setPen(snapshot.textColor);
+    painter->drawText(snapshot.textRect.translated(center - snapshot.textRect.center()), Qt::AlignCenter, snapshot.text);
+}
+
+// the item stays visible to the scene, so it keeps its selection, mouse grab
+// and hover; it only stops being painted and hit while a flag is set
+void MapItem::setHiddenFlag(HiddenFlag flag, bool state)
+{
+    const bool isHidden = d->hiddenFlags;
+
+    if (state) d->hiddenFlags |= flag;
+    else d->hiddenFlags &= ~flag;
+
+    if (isHidden == static_cast<bool>(d->hiddenFlags)) return;
+
+    // drops the device cache of the item along with the repaint
+    update();
+
+    if (d->itemPixmap)
+        d->itemPixmap->update();
+
+    if (d->itemPath)
+        d->itemPath->update();
+
+    updateFactor();
+}
+
+void MapItem::setIndex(MapSpatialIndex *index)
+{
+    d->index = index;
+}
+
+void MapItem::setClusterLayer(MapClusterLayer *layer)
+{
+    d->clusterLayer = layer;
+}
+
+// the layer draws the text instead of the text child
+void MapItem::setLabelLayer(MapLabelLayer *layer)
+{
+    d->labelLayer = layer;
+    updateFactor();
+}
+
+void MapItem::setOverlay(MapOverlay *overlay)
+{
+    d->overlay = overlay;
+}
+
+// not painted by the scene only to be drawn into overlay tiles
+bool MapItem::isRasterized() const
+{
+    return isVisible() && (d->hiddenFlags & Rasterized) && !(d->hiddenFlags & Pending);
+}
+
+// painted by the scene, visible and without hidden flags
+bool MapItem::isShown() const
+{
+    return isVisible() && !d->hiddenFlags;
+}
+
+// scene position of the text center
+QPointF MapItem::textAnchor() const
+{
+    if (d->path.isEmpty())
+        return pos() + d->textIndent * d->settings.factor();
+
+    return pos() + d->path.boundingRect().center() + d->textIndent;
+}
+
+// pixels, 0 if the text may be wider than the item
+qreal MapItem::textWidthLimit() const
+{
+    if (d->path.isEmpty()) return 0.;
+
+    return d->path.boundingRect().width() / d->settings.factor();
+}
+
+// rect in scene units, margin in pixels for the parts scaled with the factor
+void MapItem::indexGeometry(QRectF &rect, qreal &margin) const
+{
+    if (!d->path.isEmpty())
+    {
+        rect = d->path.boundingRect().translated(pos());
+        margin = d->style.pen().widthF();
+        return;
+    }
+
+    const QRectF bounds = boundingRect() | childrenBoundingRect();
+    rect = QRectF(pos(), QSizeF(0., 0.));
+    margin = qMax(qMax(qAbs(bounds.left()), qAbs(bounds.right())),
+                  qMax(qAbs(bounds.top()), qAbs(bounds.bottom())));
+}
+
+bool MapItem::hitTest(const QPointF &point) const
+{
+    if (d->path.isEmpty())
+    {
+        // dynamic items ignore the view transform, their geometry is in pixels
+        const QPointF local = (point - pos()) / d->settings.factor();
+        return (boundingRect() | childrenBoundingRect()).contains(local);
+    }
+
+    const QPointF local = mapFromScene(point);
+
+    if (d->isClosed || d->type != MapItemType::StaticPath)
+        return currentPath().contains(local);
+
+    QPainterPathStroker stroker;
+    stroker.setWidth((d->style.pen().widthF() + 4.) * d->settings.factor());
+    return stroker.createStroke(currentPath()).contains(local);
+}
+
+MapItemType MapItem::itemType() const
+{
+    return d->type;
+}
+
+bool MapItem::isClosed() const
+{
+    return d->isClosed;
 }
 
 void MapItem::onPressEvent(bool state, Qt::MouseButton button)
@@ -467,6 +1174,7 @@ void MapItem::onSelectEvent(bool state)
     if (d->isSelected == state) return;
 
     d->isSelected = state;
+    updateState();
     emit selected(state);
 }
 
@@ -475,86 +1183,110 @@ void MapItem::onHoverEvent(bool state)
     if (d->isHovered == state) return;
 
     d->isHovered = state;
+    updateState();
     emit hovered(state);
 }
 
 //! \brief The MapItemPixmap class
 struct MapItemPixmap::MapItemPixmapPrivate
 {
-    QMap<MapItemState, QPixmap> pixmaps;
-    QMap<MapItemState, QBrush> brushes;
+    MapIconAtlas &atlas = MapIconAtlas::instance();
+    MapIcon icons[3]; // per MapItemState
 };
 
-MapItemPixmap::MapItemPixmap(const QPixmap &pixmap, QGraphicsItem *parent) :
-    QGraphicsPixmapItem(pixmap, parent), d(new MapItemPixmapPrivate)
+MapItemPixmap::MapItemPixmap(const MapIcon &icon, QGraphicsItem *parent) : QGraphicsItem(parent),
+    d(new MapItemPixmapPrivate)
 {
     setAcceptHoverEvents(true);
-
-    d->pixmaps = { { MapItemState::Default, pixmap },
-                   { MapItemState::Hovered, QPixmap() },
-                   { MapItemState::Selected, QPixmap() } };
-
-    d->brushes = { {MapItemState::Default,     QBrush(Qt::NoBrush)},
-                   {MapItemState::Hovered,     QBrush(Qt::NoBrush)},
-                   {MapItemState::Selected,    QBrush(Qt::NoBrush)} };
+    d->icons[static_cast<int>(MapItemState::Default)] = icon;
 }
 
 MapItemPixmap::~MapItemPixmap()
 {
+    delete d;
 }
 
-void MapItemPixmap::setItemPixmap(const QPixmap &pixmap, MapItemState state)
+void MapItemPixmap::setIcon(const MapIcon &icon, MapItemState state)
 {
-    d->pixmaps[state] = pixmap;
-    update(boundingRect());
+    if (state == MapItemState::AllState)
+    {
+        for (MapIcon &stateIcon: d->icons)
+            stateIcon = icon;
+    }
+    else d->icons[static_cast<int>(state)] = icon;
+
+    if (state == MapItemState::Default || state == MapItemState::AllState)
+        prepareGeometryChange();
+
+    update();
 }
 
 void MapItemPixmap::setMaskBrush(const QBrush &brush, MapItemState state)
 {
-    d->brushes[state] = brush;
-    update(boundingRect());
+    static_cast<MapItem*>(parentItem())->setMaskBrush(brush, state);
+}
+
+QRectF MapItemPixmap::boundingRect() const
+{
+    return QRectF(QPointF(0., 0.), d->icons[static_cast<int>(MapItemState::Default)].rect.size());
+}
+
+QPainterPath MapItemPixmap::shape() const
+{
+    QPainterPath path;
+    if (static_cast<MapItem*>(parentItem())->d->hiddenFlags) return path;
+
+    path.addRegion(d->atlas.mask(d->icons[static_cast<int>(MapItemState::Default)]));
+    return path;
 }
 
 void MapItemPixmap::paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget)
 {
-    QStyleOptionGraphicsItem option(*item);
-    option.state &= ~QStyle::State_Selected;
+    Q_UNUSED(item);
+    Q_UNUSED(widget);
 
-    QGraphicsPixmapItem::paint(painter, &option, widget);
+    const MapItem *parent = static_cast<MapItem*>(parentItem());
+    if (parent->d->hiddenFlags) return;
 
-    bool isHovered = item->state & QStyle::State_MouseOver;
-    bool isSelected = item->state & QStyle::State_Selected;
+    const MapItemState state = parent->state();
 
-    if (parentItem()->isSelected() != isSelected)
-        parentItem()->setSelected(isSelected);
+    const MapIcon &defaultIcon = d->icons[static_cast<int>(MapItemState::Default)];
+    const MapIcon &stateIcon = d->icons[static_cast<int>(state)];
+    const MapIcon &icon = stateIcon.isNull() ? defaultIcon : stateIcon;
 
-    if (isSelected)
-    {
-        if (!d->pixmaps.value(MapItemState::Selected).isNull())
-            setPixmap(d->pixmaps.value(MapItemState::Selected));
+    painter->setRenderHint(QPainter::SmoothPixmapTransform);
+    painter->drawPixmap(boundingRect(), d->atlas.page(icon.page), icon.rect);
 
-        if (d->brushes.value(MapItemState::Selected) != Qt::NoBrush)
-        {
-            painter->setClipRegion(QRegion(d->pixmaps.value(MapItemState::Default).mask()));
-            painter->setBrush(d->brushes.value(MapItemState::Selected));
-            painter->drawRect(boundingRect());
-        }
-    }
-    else if (isHovered)
-    {
-        if (!d->pixmaps.value(MapItemState::Hovered).isNull())
-            setPixmap(d->pixmaps.value(MapItemState::Hovered));
+    const MapStyle &style = parent->d->style;
 
-        if (d->brushes.value(MapItemState::Hovered) != Qt::NoBrush)
-        {
-            painter->setClipRegion(QRegion(d->pixmaps.value(MapItemState::Default).mask()));
-            painter->setBrush(d->brushes.value(MapItemState::Hovered));
-            painter->drawRect(boundingRect());
-        }
+    if (state != MapItemState::Default && style.maskBrush(state) != Qt::NoBrush)
+    {
+        painter->setClipRegion(d->atlas.mask(defaultIcon));
+        painter->setPen(Qt::NoPen);
+        painter->setBrush(style.maskBrush(state));
+        painter->drawRect(boundingRect());
     }
+}
+
+// paint() from the page images, the state mask is made from the icon alpha
+QVariant MapItemPixmap::itemChange(GraphicsItemChange change, const QVariant &value)
+{
+    if (change == ItemSelectedHasChanged)
+        parentItem()->setSelected(value.toBool());
+
+    return QGraphicsItem::itemChange(change, value);
+}
 
-    dynamic_cast<MapItem*>(parentItem())->onHoverEvent(isHovered);
-    dynamic_cast<MapItem*>(parentItem())->onSelectEvent(isSelected);
+void MapItemPixmap::hoverEnterEvent(QGraphicsSceneHoverEvent *event)
+{
+    QGraphicsItem::hoverEnterEvent(event);
+    dynamic_cast<MapItem*>(parentItem())->onHoverEvent(true);
+}
+
+void MapItemPixmap::hoverLeaveEvent(QGraphicsSceneHoverEvent *event)
+{
+    QGraphicsItem::hoverLeaveEvent(event);
+    dynamic_cast<MapItem*>(parentItem())->onHoverEvent(false);
 }
 
 void MapItemPixmap::mousePressEvent(QGraphicsSceneMouseEvent *event)
@@ -574,8 +1306,6 @@ struct MapItemPath::MapItemShapePrivate
 {
     MapGlobal &settings = MapGlobal::instance();
     QPainterPath path;
-    QMap<MapItemState, QPen> pens;
-    QMap<MapItemState, QBrush> brushes;
 };
 
 MapItemPath::MapItemPath(const QPainterPath &path, QGraphicsItem *parent):
@@ -584,13 +1314,6 @@ MapItemPath::MapItemPath(const QPainterPath &path, QGraphicsItem *parent):
     setAcceptHoverEvents(true);
 
     d->path = path;
-    d->pens = { {MapItemState::Default,    QPen(QBrush(QColor(Qt::black)), 1)},
-                {MapItemState::Hovered,    QPen(QBrush(QColor(Qt::black)), 1)},
-                {MapItemState::Selected,   QPen(QBrush(QColor(Qt::black)), 1)} };
-
-    d->brushes = { {MapItemState::Default,     QBrush(QColor(0, 0, 0, 0))},
-                   {MapItemState::Hovered,     QBrush(QColor(0, 0, 0, 0))},
-                   {MapItemState::Selected,    QBrush(QColor(0, 0, 0, 0))} };
 }
 
 MapItemPath::~MapItemPath()
@@ -600,28 +1323,12 @@ MapItemPath::~MapItemPath()
 
 void MapItemPath::setPen(const QPen &pen, MapItemState state)
 {
-    if (state == MapItemState::AllState)
-    {
-        d->pens[MapItemState::Default] = pen;
-        d->pens[MapItemState::Hovered] = pen;
-        d->pens[MapItemState::Selected] = pen;
-    }
-    else d->pens[state] = pen;
-
-    update(boundingRect());
+    static_cast<MapItem*>(parentItem())->setPen(pen, state);
 }
 
 void MapItemPath::setBrush(const QBrush &brush, MapItemState state)
 {
-    if (state == MapItemState::AllState)
-    {
-        d->brushes[MapItemState::Default] = brush;
-        d->brushes[MapItemState::Hovered] = brush;
-        d->brushes[MapItemState::Selected] = brush;
-    }
-    else d->brushes[state] = brush;
-
-    update(boundingRect());
+    static_cast<MapItem*>(parentItem())->setBrush(brush, state);
 }
 
 QRectF MapItemPath::boundingRect() const
@@ -631,33 +1338,46 @@ QRectF MapItemPath::boundingRect() const
 
 QPainterPath MapItemPath::shape() const
 {
+    if (static_cast<MapItem*>(parentItem())->d->hiddenFlags) return QPainterPath();
+
     return d->path;
 }
 
 void MapItemPath::paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget)
 {
+    Q_UNUSED(item);
     Q_UNUSED(widget);
 
-    QStyleOptionGraphicsItem option(*item);
-    option.state &= ~QStyle::State_Selected;
-
-    bool isHovered = item->state & QStyle::State_MouseOver;
-    bool isSelected = item->state & QStyle::State_Selected;
-
-    if (parentItem()->isSelected() != isSelected)
-        parentItem()->setSelected(isSelected);
+    const MapItem *parent = static_cast<MapItem*>(parentItem());
+    if (parent->d->hiddenFlags) return;
 
-    MapItemState state = MapItemState::Default;
-    if (isSelected) state = MapItemState::Selected;
-    else if(isHovered) state = MapItemState::Hovered;
+    const MapItemState state = parent->state();
+    const MapStyle &style = parent->d->style;
 
     painter->setRenderHint(QPainter::Antialiasing);
-    painter->setBrush(d->brushes.value(state));
-    painter->setPen(d->pens.value(state));
+    painter->setBrush(style.brush(state));
+    painter->setPen(style.pen(state));
     painter->drawPath(d->path);
+}
+
+QVariant MapItemPath::itemChange(GraphicsItemChange change, const QVariant &value)
+{
+    if (change == ItemSelectedHasChanged)
+        parentItem()->setSelected(value.toBool());
 
-    dynamic_cast<MapItem*>(parentItem())->onHoverEvent(isHovered);
-    dynamic_cast<MapItem*>(parentItem())->onSelectEvent(isSelected);
+    return QGraphicsItem::itemChange(change, value);
+}
+
+void MapItemPath::hoverEnterEvent(QGraphicsSceneHoverEvent *event)
+{
+    QGraphicsItem::hoverEnterEvent(event);
+    dynamic_cast<MapItem*>(parentItem())->onHoverEvent(true);
+}
+
+void MapItemPath::hoverLeaveEvent(QGraphicsSceneHoverEvent *event)
+{
+    QGraphicsItem::hoverLeaveEvent(event);
+    dynamic_cast<MapItem*>(parentItem())->onHoverEvent(false);
 }
 
 void MapItemPath::mousePressEvent(QGraphicsSceneMouseEvent *event)
@@ -1,16 +1,12 @@
 #pragma once
 
+#include "mapiconatlas.h"
+#include "mapstyle.h"
+#include "mapglobal.h"
+
 #include <QGraphicsSceneHoverEvent>
-#include <QGraphicsPixmapItem>
 #include <QGraphicsItem>
-
-enum class MapItemState
-{
-    Default = 0,
-    Hovered,
-    Selected,
-    AllState
-};
+#include <QPainterPath>
 
 enum class MapItemType
 {
@@ -20,7 +16,52 @@ enum class MapItemType
     StaticEllipse
 };
 
+// static item geometry in one projection, path is relative to origin
+struct MapItemGeometry
+{
+    CoordsTypes coordsType = Spherical;
+    QPointF origin;
+    QPainterPath path;
+    QVector<QPainterPath> levels; // path simplified for factor 2^(index + 1)
+};
+
+// copy of an item taken in the thread of the item, MapRenderer projects and
+// paints it in worker threads. Paths and images are shared with the item.
+struct MapItemSnapshot
+{
+    MapItemType type = MapItemType::DynamicItem;
+    QVector<QPointF> coords; // projected by the worker if isProjected is not set
+    bool isClosed = false;
+    bool isProjected = false;
+
+    QPointF origin;    // position in the scene of the render
+    QPainterPath path; // static items, level of detail of the render
+    qreal margin = 0.; // in pixels around the path or the origin
+    qreal zValue = 0.;
+
+    QPen pen;
+    QBrush brush;
+    QPainterPath shape; // MapItemPath child
+    QTransform shapeTransform;
+
+    QImage icon; // MapIconAtlas page, shared with the atlas
+    QRect iconSource;
+    QImage iconMask; // default icon filled with the mask brush of the state
+    QRectF iconRect;
+    QTransform iconTransform;
+
+    QString text;
+    QRectF textRect;
+    QFont font;
+    QColor textColor;
+    QPointF textIndent;
+};
+
 class MapItemPixmap;
+class MapSpatialIndex;
+class MapClusterLayer;
+class MapLabelLayer;
+class MapOverlay;
 
 class MapItem : public QGraphicsObject
 {
@@ -44,8 +85,15 @@ public:
     void setColor(const QColor &color); //text color
     void setMaskBrush(const QBrush &brush, MapItemState state = MapItemState::Selected); // if used as pixmap item
 
+    // the setters above give the item its own copy of a shared style
+    void setStyle(const MapStyle &style);
+    void setStyle(int handle); // MapStyleRegistry handle
+    MapStyle style() const;
+    int styleHandle() const;   // -1 if the item has its own style
+
     void setPixmap(const QPixmap &pixmap, const QSize &size, MapItemState state = MapItemState::Default);
     void setText(const QString &text, const QPoint &indent = QPoint(0, 0));
+    void setTextPriority(int priority); // labels with higher priority win overlaps in MapLabelLayer
 
     void setPath(const QPainterPath &path);
     void setRect(const QSize &size, const QSize &radius = QSize(0, 0));
@@ -60,6 +108,8 @@ public:
     bool isStatic();
     bool isInMove();
     QFont font();
+    QString text() const;
+    int textPriority() const;
 
     void updateCoords();
 
@@ -76,7 +126,58 @@ signals:
 private:
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget);
     QVariant itemChange(GraphicsItemChange change, const QVariant &value);
-    void checkScale();
+    void hoverEnterEvent(QGraphicsSceneHoverEvent *event);
+    void hoverLeaveEvent(QGraphicsSceneHoverEvent *event);
+    void updateFactor();
+    MapItemSnapshot snapshot(CoordsTypes coordsType, qreal factor) const;
+    static void projectSnapshot(MapItemSnapshot &snapshot, CoordsTypes coordsType);
+    static void render(QPainter *painter, const MapItemSnapshot &snapshot, qreal factor);
+    void updateTextPos();
+    void updateTextColor();
+    void updateState();
+    void applyStyle(const MapStyle &style);
+    MapItemState state() const;
+
+    void setPosition(const QPointF &coords, const QPointF &point, bool isBatch = false);
+    void resetGeometry();
+    void applyGeometry(const MapItemGeometry &geometry);
+    void insertGeometry(const MapItemGeometry &geometry, quint64 version);
+    void setStaticGeometry(MapItemType type, const QVector<QPointF> &coords, bool closed,
+                           const MapItemGeometry &geometry);
+    bool hasGeometry(CoordsTypes type) const;
+    quint64 geometryVersion() const;
+    static MapItemGeometry projectGeometry(MapItemType type, const QVector<QPointF> &coords,
+                                           bool closed, CoordsTypes coordsType);
+
+    void updateLevels();
+    void waitForLevels();
+    void onLevelsReady();
+    const QPainterPath &currentPath() const;
+    const QPainterPath &currentPath(qreal factor) const;
+    static QVector<QPainterPath> buildLevels(const QPainterPath &path, bool closed);
+
+    // reasons not to paint the item besides setVisible(false)
+    enum HiddenFlag
+    {
+        Culled = 1,  // outside of the MapView viewport
+        Pending = 2,  // geometry for the current projection is not ready
+        Clustered = 4, // drawn as a part of a MapClusterLayer marker
+        Rasterized = 8 // drawn into MapOverlay tiles
+    };
+
+    void setHiddenFlag(HiddenFlag flag, bool state);
+    void setIndex(MapSpatialIndex *index);
+    void setClusterLayer(MapClusterLayer *layer);
+    void setLabelLayer(MapLabelLayer *layer);
+    void setOverlay(MapOverlay *overlay);
+    bool isRasterized() const;
+    QPointF textAnchor() const;
+    qreal textWidthLimit() const;
+    bool isShown() const;
+    void indexGeometry(QRectF &rect, qreal &margin) const;
+    bool hitTest(const QPointF &point) const;
+    MapItemType itemType() const;
+    bool isClosed() const;
 
     void onPressEvent(bool state, Qt::MouseButton button);
     void onSelectEvent(bool state);
@@ -84,26 +185,43 @@ private:
 
     friend class MapItemPixmap;
     friend class MapItemPath;
+    friend class MapRenderer;
+    friend class MapView;
+    friend class MapSpatialIndex;
+    friend class MapClusterLayer;
+    friend class MapLabelLayer;
+    friend class MapOverlay;
+    friend class MapImporter;
+    friend class MapStyleRegistry;
+    friend class MapBenchmark;
 
     struct MapItemPrivate;
     MapItemPrivate * const d;
 };
 
-//! \brief The MapItemPixmap class
-class MapItemPixmap : public QGraphicsPixmapItem
+//! \brief The MapItemPixmap class, draws its icons from the MapIconAtlas pages
+class MapItemPixmap : public QGraphicsItem
 {
 public:
-    MapItemPixmap(const QPixmap &pixmap, QGraphicsItem *parent);
+    MapItemPixmap(const MapIcon &icon, QGraphicsItem *parent);
     ~MapItemPixmap();
 
-    void setItemPixmap(const QPixmap &pixmap, MapItemState state = MapItemState::Default);
-    void setMaskBrush(const QBrush &brush, MapItemState state = MapItemState::Default);
+    void setIcon(const MapIcon &icon, MapItemState state = MapItemState::Default);
+    void setMaskBrush(const QBrush &brush, MapItemState state = MapItemState::Default); // sets the style of the parent item
+
+    QRectF boundingRect() const;
+    QPainterPath shape() const;
 
 private:
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget);
+    QVariant itemChange(GraphicsItemChange change, const QVariant &value);
+    void hoverEnterEvent(QGraphicsSceneHoverEvent *event);
+    void hoverLeaveEvent(QGraphicsSceneHoverEvent *event);
     void mousePressEvent(QGraphicsSceneMouseEvent *event);
     void mouseReleaseEvent(QGraphicsSceneMouseEvent *event);
 
+    friend class MapItem;
+
     struct MapItemPixmapPrivate;
     MapItemPixmapPrivate * const d;
 };
@@ -115,6 +233,7 @@ public:
     MapItemPath(const QPainterPath &path, QGraphicsItem *parent);
     ~MapItemPath();
 
+    // set the style of the parent item
     void setPen(const QPen &pen, MapItemState state = MapItemState::Default);
     void setBrush(const QBrush &brush, MapItemState state = MapItemState::Default);
 
@@ -123,6 +242,9 @@ public:
 
 private:
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget);
+    QVariant itemChange(GraphicsItemChange change, const QVariant &value);
+    void hoverEnterEvent(QGraphicsSceneHoverEvent *event);
+    void hoverLeaveEvent(QGraphicsSceneHoverEvent *event);
     void mousePressEvent(QGraphicsSceneMouseEvent *event);
     void mouseReleaseEvent(QGraphicsSceneMouseEvent *event);
 
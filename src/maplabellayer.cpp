@@ -0,0 +1,278 @@
+#include "maplabellayer.h"
+#include "mapitem.h"
+
+#include <QStaticText>
+#include <QPainter>
+#include <QtMath>
+#include <QHash>
+#include <QSet>
+#include <algorithm>
+
+// side of the grid cells used to find overlaps, pixels
+static const int LABEL_CELL_SIZE = 64;
+
+struct LabelEntry
+{
+    QString text;
+    QFont font;
+    QStaticText layout;
+    int serial = 0;
+};
+
+struct PlacedLabel
+{
+    MapItem *item;
+    QPointF pos; // top left, pixels from the viewport corner
+};
+
+static inline quint64 cellKey(qint64 x, qint64 y)
+{
+    return (static_cast<quint64>(static_cast<quint32>(x)) << 32) | static_cast<quint32>(y);
+}
+
+struct MapLabelLayer::MapLabelLayerPrivate
+{
+    int spacing = 2;
+    int serial = 0;
+    qreal factor = 1.;
+    bool isDirty = true;
+
+    QRectF boundingRect;
+    QSet<MapItem*> items;
+    QHash<MapItem*, LabelEntry> entries;
+    QVector<PlacedLabel> placed;
+
+    void update(MapItem *item);
+};
+
+void MapLabelLayer::MapLabelLayerPrivate::update(MapItem *item)
+{
+    const QString text = item->text();
+
+    if (text.isEmpty())
+    {
+        entries.remove(item);
+        return;
+    }
+
+    auto it = entries.find(item);
+    if (it == entries.end())
+    {
+        it = entries.insert(item, LabelEntry());
+        it.value().serial = serial++;
+    }
+
+    // the layout is prepared again only for a new text or font
+    LabelEntry &entry = it.value();
+    const QFont font = item->font();
+
+    if (entry.text != text || entry.font != font)
+    {
+        entry.text = text;
+        entry.font = font;
+        entry.layout = QStaticText(text);
+        entry.layout.setTextFormat(Qt::PlainText);
+        entry.layout.setPerformanceHint(QStaticText::AggressiveCaching);
+        entry.layout.prepare(QTransform(), font);
+    }
+}
+
+MapLabelLayer::MapLabelLayer(QGraphicsItem *parent) : QGraphicsObject(parent),
+    d(new MapLabelLayerPrivate)
+{
+    setZValue(3);
+    setAcceptedMouseButtons(Qt::NoButton);
+}
+
+MapLabelLayer::~MapLabelLayer()
+{
+    clear();
+    delete d;
+}
+
+void MapLabelLayer::setSpacing(int pixels)
+{
+    d->spacing = qMax(0, pixels);
+    d->isDirty = true;
+    update();
+}
+
+int MapLabelLayer::spacing() const
+{
+    return d->spacing;
+}
+
+void MapLabelLayer::insertItem(MapItem *item)
+{
+    d->items.insert(item);
+    item->setLabelLayer(this);
+    updateItem(item);
+}
+
+void MapLabelLayer::removeItem(MapItem *item)
+{
+    if (!d->items.remove(item)) return;
+
+    d->entries.remove(item);
+    item->setLabelLayer(Q_NULLPTR);
+
+    d->isDirty = true;
+    update();
+}
+
+void MapLabelLayer::updateItem(MapItem *item)
+{
+    d->update(item);
+    d->isDirty = true;
+    update();
+}
+
+void MapLabelLayer::updateItems(const QVector<MapItem*> &items)
+{
+    for (MapItem *item: items)
+        d->update(item);
+
+    d->isDirty = true;
+    update();
+}
+
+void MapLabelLayer::clear()
+{
+    for (MapItem *item: qAsConst(d->items))
+        item->setLabelLayer(Q_NULLPTR);
+
+    d->items.clear();
+    d->entries.clear();
+    d->placed.clear();
+    d->isDirty = true;
+    update();
+}
+
+void MapLabelLayer::setFactor(qreal factor)
+{
+    if (qFuzzyCompare(d->factor, factor)) return;
+
+    d->factor = factor;
+    d->isDirty = true;
+    update();
+}
+
+void MapLabelLayer::setBoundingRect(const QRectF &rect)
+{
+    prepareGeometryChange();
+    d->boundingRect = rect;
+    d->isDirty = true;
+    update();
+}
+
+int MapLabelLayer::labelsCount() const
+{
+    return d->placed.size();
+}
+
+QRectF MapLabelLayer::boundingRect() const
+{
+    return d->boundingRect;
+}
+
+void MapLabelLayer::paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget)
+{
+    Q_UNUSED(item);
+    Q_UNUSED(widget);
+
+    if (d->isDirty)
+        layout();
+
+    // one pixel per unit, the prepared layouts are reused as they are
+    painter->save();
+    painter->translate(d->boundingRect.topLeft());
+    painter->scale(d->factor, d->factor);
+
+    for (const PlacedLabel &label: qAsConst(d->placed))
+    {
+        const LabelEntry &entry = d->entries[label.item];
+        painter->setPen(label.item->style().color(label.item->state()));
+        painter->setFont(entry.font);
+        painter->drawStaticText(label.pos, entry.layout);
+    }
+
+    painter->restore();
+}
+
+void MapLabelLayer::layout()
+{
+    d->isDirty = false;
+    d->placed.clear();
+
+    struct Candidate
+    {
+        MapItem *item;
+        QRectF rect;
+        int priority;
+        int serial;
+    };
+
+    QVector<Candidate> candidates;
+    const QRectF viewport(QPointF(0., 0.), d->boundingRect.size() / d->factor);
+
+    for (auto it = d->entries.cbegin(); it != d->entries.cend(); ++it)
+    {
+        MapItem *item = it.key();
+        if (!item->isShown() && !item->isRasterized()) continue; // culled, clustered or hidden
+
+        const QSizeF size = it.value().layout.size();
+        const qreal widthLimit = item->textWidthLimit();
+        if (widthLimit > 0. && size.width() > widthLimit) continue;
+
+        const QPointF center = (item->textAnchor() - d->boundingRect.topLeft()) / d->factor;
+        const QRectF rect(center - QPointF(size.width(), size.height()) / 2., size);
+        if (!viewport.intersects(rect)) continue;
+
+        candidates.append({item, rect, item->textPriority(), it.value().serial});
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+    {
+        return a.priority != b.priority ? a.priority > b.priority : a.serial < b.serial;
+    });
+
+    // placed rects by the grid cells they touch
+    QHash<quint64, QVector<QRectF>> cells;
+
+    for (const Candidate &candidate: qAsConst(candidates))
+    {
+        const QRectF rect = candidate.rect.adjusted(-d->spacing, -d->spacing, d->spacing, d->spacing);
+        const qint64 left = qFloor(rect.left() / LABEL_CELL_SIZE);
+        const qint64 right = qFloor(rect.right() / LABEL_CELL_SIZE);
+        const qint64 top = qFloor(rect.top() / LABEL_CELL_SIZE);
+        const qint64 bottom = qFloor(rect.bottom() / LABEL_CELL_SIZE);
+
+        bool isFree = true;
+
+        for (qint64 x=left; x<=right && isFree; ++x)
+        {
+            for (qint64 y=top; y<=bottom && isFree; ++y)
+            {
+                auto it = cells.constFind(cellKey(x, y));
+                if (it == cells.cend()) continue;
+
+                for (const QRectF &other: it.value())
+                {
+                    if (other.intersects(rect))
+                    {
+                        isFree = false;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (!isFree) continue;
+
+        for (qint64 x=left; x<=right; ++x)
+            for (qint64 y=top; y<=bottom; ++y)
+                cells[cellKey(x, y)].append(rect);
+
+        d->placed.append({candidate.item, candidate.rect.topLeft()});
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QGraphicsObject>
+
+class MapItem;
+
+//! \brief The MapLabelLayer class, draws the texts of visible items instead of
+//! their text children. Labels are placed by MapItem::textPriority(), a label
+//! overlapping an already placed one is dropped. Text layouts are cached as
+//! QStaticText, the placement is recomputed only after the viewport, the zoom
+//! or one of the items changes.
+class MapLabelLayer : public QGraphicsObject
+{
+    Q_OBJECT
+public:
+    explicit MapLabelLayer(QGraphicsItem *parent = Q_NULLPTR);
+    ~MapLabelLayer();
+
+    void setSpacing(int pixels); // free space kept around each label
+    int spacing() const;
+
+    void insertItem(MapItem *item);
+    void removeItem(MapItem *item);
+    void updateItem(MapItem *item);
+    void updateItems(const QVector<MapItem*> &items); // one layout for all of them
+    void clear();
+
+    void setFactor(qreal factor);
+    void setBoundingRect(const QRectF &rect);
+
+    int labelsCount() const; // placed by the last layout
+
+private:
+    QRectF boundingRect() const;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget);
+    void layout();
+
+    struct MapLabelLayerPrivate;
+    MapLabelLayerPrivate * const d;
+};
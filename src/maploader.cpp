@@ -18,8 +18,8 @@ struct MapLoader::MapLoaderPrivate
     MapGlobal &settings = MapGlobal::instance();
     QNetworkAccessManager *netAccessManager;
     QVector<QNetworkReply*> replies;
-    QString cachePath = "/z%1/%2/x%3/%4/y%5.png";
     QString currentUrl;
+    MapLoaderStats stats;
 };
 
 MapLoader::MapLoader(QObject *parent) : QObject(parent),
@@ -45,8 +45,22 @@ MapLoader::~MapLoader()
     delete d;
 }
 
+MapLoaderStats MapLoader::stats() const
+{
+    MapLoaderStats stats = d->stats;
+    stats.pending = d->replies.size();
+    return stats;
+}
+
+void MapLoader::resetStats()
+{
+    d->stats = MapLoaderStats();
+}
+
 void MapLoader::update()
 {
+    d->stats.aborted += static_cast<quint64>(d->replies.size());
+
     foreach (QNetworkReply *reply, d->replies)
     {
         reply->disconnect();
@@ -63,14 +77,18 @@ void MapLoader::loadTile(const QPoint &pos)
 
     QString cache = createCachePath(pos);
     QPixmap pix;
+    ++d->stats.requested;
 
     if(QPixmapCache::find(cache, &pix))
     {
+        ++d->stats.memoryHits;
         emit loaded(pos, pix);
+        return;
     }
 
     if(loadFile(cache, pix))
     {
+        ++d->stats.diskHits;
         emit loaded(pos, pix);
     }
     else
@@ -93,9 +111,16 @@ void MapLoader::requestFinished()
     d->replies.removeOne(reply);
 
     if(reply->error() != QNetworkReply::NoError)
+    {
+        ++d->stats.failed;
+        reply->disconnect();
+        reply->deleteLater();
         return;
+    }
 
     QByteArray data = reply->readAll();
+    ++d->stats.fetched;
+    d->stats.bytesFetched += static_cast<quint64>(data.size());
     const QPoint pos = reply->property("id").toPoint();
 
     QPixmap pix;
@@ -113,8 +138,7 @@ void MapLoader::requestFinished()
 
 QString MapLoader::createCachePath(const QPoint &pos)
 {
-    return d->settings.cachePathSuffix() + d->cachePath.arg(d->settings.zoom()).
-            arg(pos.x()/1024).arg(pos.x()).arg(pos.y()/1024).arg(pos.y());
+    return d->settings.tileCachePath(pos, d->settings.zoom());
 }
 
 void MapLoader::saveFile(const QString &path, const QByteArray &data)
@@ -2,6 +2,19 @@
 
 #include <QObject>
 
+//! \brief The MapLoaderStats struct, counters of tile loads
+struct MapLoaderStats
+{
+    quint64 requested = 0;
+    quint64 memoryHits = 0;
+    quint64 diskHits = 0;
+    quint64 fetched = 0;
+    quint64 failed = 0;
+    quint64 aborted = 0; // by a zoom change
+    quint64 bytesFetched = 0;
+    int pending = 0;     // requests in flight
+};
+
 class MapLoader : public QObject
 {
     Q_OBJECT
@@ -9,6 +22,9 @@ public:
     explicit MapLoader(QObject *parent = Q_NULLPTR);
     ~MapLoader();
 
+    MapLoaderStats stats() const;
+    void resetStats();
+
 signals:
     void loaded(const QPoint &pos, const QPixmap &pix);
 
@@ -0,0 +1,343 @@
+#include "mapmarkerlayer.h"
+#include "mapiconatlas.h"
+#include "mapglobal.h"
+
+#include <QPainter>
+
+static const int STATES_COUNT = 3;
+
+struct MapMarkerLayer::MapMarkerLayerPrivate
+{
+    MapGlobal &settings = MapGlobal::instance();
+    MapIconAtlas &atlas = MapIconAtlas::instance();
+    QRectF boundingRect;
+
+    // one row per marker
+    QVector<QPointF> coords;
+    QVector<QPointF> points;
+    QVector<float> headings;
+    QVector<quint16> icons;
+    QVector<quint8> states;
+    QVector<int> ids;
+
+    QVector<int> rows; // row of each id, -1 for free ids
+    QVector<int> freeIds;
+
+    QVector<MapIcon> atlasIcons; // icon * STATES_COUNT + state
+    QVector<QVector<QPainter::PixmapFragment>> fragments; // per atlas page
+
+    int row(int id) const { return id >= 0 && id < rows.size() ? rows.at(id) : -1; }
+    int allocateId();
+    const MapIcon &atlasIcon(int icon, int state) const;
+};
+
+int MapMarkerLayer::MapMarkerLayerPrivate::allocateId()
+{
+    if (!freeIds.isEmpty())
+        return freeIds.takeLast();
+
+    rows.append(-1);
+    return rows.size() - 1;
+}
+
+const MapIcon &MapMarkerLayer::MapMarkerLayerPrivate::atlasIcon(int icon, int state) const
+{
+    static const MapIcon empty;
+
+    const int index = icon * STATES_COUNT + state;
+    if (index >= atlasIcons.size()) return empty;
+
+    if (atlasIcons.at(index).isNull())
+        return atlasIcons.at(icon * STATES_COUNT);
+
+    return atlasIcons.at(index);
+}
+
+MapMarkerLayer::MapMarkerLayer(QGraphicsItem *parent) : QGraphicsObject(parent),
+    d(new MapMarkerLayerPrivate)
+{
+    setZValue(1);
+    setAcceptedMouseButtons(Qt::NoButton);
+}
+
+MapMarkerLayer::~MapMarkerLayer()
+{
+    delete d;
+}
+
+void MapMarkerLayer::setIcon(int icon, const QPixmap &pixmap, MapItemState state)
+{
+    if (icon < 0 || icon > 0xffff) return;
+
+    if (d->atlasIcons.size() < (icon + 1) * STATES_COUNT)
+        d->atlasIcons.resize((icon + 1) * STATES_COUNT);
+
+    const MapIcon atlasIcon = d->atlas.icon(pixmap);
+
+    if (state == MapItemState::AllState)
+    {
+        for (int i=0; i<STATES_COUNT; ++i)
+            d->atlasIcons[icon * STATES_COUNT + i] = atlasIcon;
+    }
+    else d->atlasIcons[icon * STATES_COUNT + static_cast<int>(state)] = atlasIcon;
+
+    update();
+}
+
+int MapMarkerLayer::addMarker(const QPointF &coords, int icon, qreal heading)
+{
+    const int id = d->allocateId();
+    d->rows[id] = d->ids.size();
+
+    d->coords.append(coords);
+    d->points.append(d->settings.toPoint(coords));
+    d->headings.append(static_cast<float>(heading));
+    d->icons.append(static_cast<quint16>(icon));
+    d->states.append(static_cast<quint8>(MapItemState::Default));
+    d->ids.append(id);
+
+    update();
+    return id;
+}
+
+QVector<int> MapMarkerLayer::addMarkers(const QVector<QPointF> &coords, int icon)
+{
+    const int first = d->ids.size();
+    const int count = coords.size();
+    QVector<int> ids(count);
+
+    d->coords.append(coords);
+    d->points.resize(first + count);
+    d->headings.resize(first + count);
+    d->icons.resize(first + count);
+    d->states.resize(first + count);
+    d->ids.resize(first + count);
+
+    d->settings.toPoints(coords.constData(), d->points.data() + first, count);
+
+    for (int i=0; i<count; ++i)
+    {
+        const int id = d->allocateId();
+        d->rows[id] = first + i;
+        d->ids[first + i] = id;
+        d->headings[first + i] = 0.f;
+        d->icons[first + i] = static_cast<quint16>(icon);
+        d->states[first + i] = static_cast<quint8>(MapItemState::Default);
+        ids[i] = id;
+    }
+
+    update();
+    return ids;
+}
+
+void MapMarkerLayer::removeMarker(int id)
+{
+    const int row = d->row(id);
+    if (row < 0) return;
+
+    // the last row takes the place of the removed one
+    const int last = d->ids.size() - 1;
+    d->coords[row] = d->coords.at(last);
+    d->points[row] = d->points.at(last);
+    d->headings[row] = d->headings.at(last);
+    d->icons[row] = d->icons.at(last);
+    d->states[row] = d->states.at(last);
+    d->ids[row] = d->ids.at(last);
+    d->rows[d->ids.at(row)] = row;
+
+    d->coords.removeLast();
+    d->points.removeLast();
+    d->headings.removeLast();
+    d->icons.removeLast();
+    d->states.removeLast();
+    d->ids.removeLast();
+
+    d->rows[id] = -1;
+    d->freeIds.append(id);
+
+    update();
+}
+
+void MapMarkerLayer::clear()
+{
+    d->coords.clear();
+    d->points.clear();
+    d->headings.clear();
+    d->icons.clear();
+    d->states.clear();
+    d->ids.clear();
+    d->rows.clear();
+    d->freeIds.clear();
+
+    update();
+}
+
+bool MapMarkerLayer::contains(int id) const
+{
+    return d->row(id) >= 0;
+}
+
+int MapMarkerLayer::count() const
+{
+    return d->ids.size();
+}
+
+void MapMarkerLayer::setPosition(int id, const QPointF &coords)
+{
+    const int row = d->row(id);
+    if (row < 0) return;
+
+    d->coords[row] = coords;
+    d->points[row] = d->settings.toPoint(coords);
+    update();
+}
+
+void MapMarkerLayer::setPositions(const QVector<int> &ids, const QVector<QPointF> &coords,
+                                  const QVector<qreal> &headings)
+{
+    const int count = qMin(ids.size(), coords.size());
+    QVector<QPointF> points(count);
+    d->settings.toPoints(coords.constData(), points.data(), count);
+
+    for (int i=0; i<count; ++i)
+    {
+        const int row = d->row(ids.at(i));
+        if (row < 0) continue;
+
+        d->coords[row] = coords.at(i);
+        d->points[row] = points.at(i);
+
+        if (i < headings.size() && !qIsNaN(headings.at(i)))
+            d->headings[row] = static_cast<float>(headings.at(i));
+    }
+
+    update();
+}
+
+QPointF MapMarkerLayer::position(int id) const
+{
+    const int row = d->row(id);
+    return row < 0 ? QPointF() : d->coords.at(row);
+}
+
+void MapMarkerLayer::setHeading(int id, qreal heading)
+{
+    const int row = d->row(id);
+    if (row < 0) return;
+
+    d->headings[row] = static_cast<float>(heading);
+    update();
+}
+
+void MapMarkerLayer::setMarkerIcon(int id, int icon)
+{
+    const int row = d->row(id);
+    if (row < 0) return;
+
+    d->icons[row] = static_cast<quint16>(icon);
+    update();
+}
+
+void MapMarkerLayer::setState(int id, MapItemState state)
+{
+    const int row = d->row(id);
+    if (row < 0 || state == MapItemState::AllState) return;
+
+    d->states[row] = static_cast<quint8>(state);
+    update();
+}
+
+MapItemState MapMarkerLayer::state(int id) const
+{
+    const int row = d->row(id);
+    return row < 0 ? MapItemState::Default : static_cast<MapItemState>(d->states.at(row));
+}
+
+int MapMarkerLayer::markerAt(const QPointF &coords) const
+{
+    const QPointF point = d->settings.toPoint(coords);
+    const qreal factor = d->settings.factor();
+
+    // the last painted marker is on top
+    for (int row=d->ids.size() - 1; row>=0; --row)
+    {
+        const QRect &rect = d->atlasIcon(d->icons.at(row), d->states.at(row)).rect;
+        const qreal width = rect.width() * factor / 2.;
+        const qreal height = rect.height() * factor / 2.;
+        const QPointF delta = point - d->points.at(row);
+
+        if (qAbs(delta.x()) <= width && qAbs(delta.y()) <= height)
+            return d->ids.at(row);
+    }
+
+    return -1;
+}
+
+void MapMarkerLayer::updateCoords()
+{
+    d->settings.toPoints(d->coords.constData(), d->points.data(), d->coords.size());
+    update();
+}
+
+void MapMarkerLayer::setBoundingRect(const QRectF &rect)
+{
+    prepareGeometryChange();
+    d->boundingRect = rect;
+    update();
+}
+
+QRectF MapMarkerLayer::boundingRect() const
+{
+    return d->boundingRect;
+}
+
+void MapMarkerLayer::paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget)
+{
+    Q_UNUSED(item);
+    Q_UNUSED(widget);
+
+    if (d->atlasIcons.isEmpty()) return;
+
+    const qreal factor = d->settings.factor();
+    const int groups = d->atlasIcons.size();
+    d->fragments.resize(d->atlas.pagesCount());
+
+    for (QVector<QPainter::PixmapFragment> &fragments: d->fragments)
+        fragments.clear();
+
+    // markers near the edges are kept, the largest icon fits into the margin
+    qreal margin = 0.;
+    for (const MapIcon &icon: qAsConst(d->atlasIcons))
+        margin = qMax(margin, static_cast<qreal>(qMax(icon.rect.width(), icon.rect.height())));
+
+    margin *= factor;
+    const QRectF rect = d->boundingRect.adjusted(-margin, -margin, margin, margin);
+    const QPointF *points = d->points.constData();
+
+    for (int row=0; row<d->ids.size(); ++row)
+    {
+        const QPointF &point = points[row];
+        if (point.x() < rect.left() || point.x() > rect.right() ||
+            point.y() < rect.top() || point.y() > rect.bottom()) continue;
+
+        const int group = d->icons.at(row) * STATES_COUNT + d->states.at(row);
+        if (group >= groups) continue;
+
+        const MapIcon &icon = d->atlasIcon(d->icons.at(row), d->states.at(row));
+        if (icon.isNull()) continue;
+
+        d->fragments[icon.page].append(QPainter::PixmapFragment::create(
+                                           point, icon.rect, factor, factor, d->headings.at(row)));
+    }
+
+    painter->setRenderHint(QPainter::SmoothPixmapTransform);
+
+    // one call per atlas page, usually a single one for all icons and states
+    for (int page=0; page<d->fragments.size(); ++page)
+    {
+        const QVector<QPainter::PixmapFragment> &fragments = d->fragments.at(page);
+        if (fragments.isEmpty()) continue;
+
+        painter->drawPixmapFragments(fragments.constData(), fragments.size(), d->atlas.page(page));
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "mapitem.h"
+
+#include <QGraphicsObject>
+#include <QPixmap>
+#include <QVector>
+
+//! \brief The MapMarkerLayer class, many point markers in one item. Markers are
+//! rows of contiguous arrays (coords, scene points, headings, icons, states)
+//! addressed by stable ids. Icons live in the MapIconAtlas, markers are painted
+//! with one drawPixmapFragments() call per atlas page and keep their size in pixels.
+class MapMarkerLayer : public QGraphicsObject
+{
+    Q_OBJECT
+public:
+    explicit MapMarkerLayer(QGraphicsItem *parent = Q_NULLPTR);
+    ~MapMarkerLayer();
+
+    // a state without its own pixmap is drawn with the default one
+    void setIcon(int icon, const QPixmap &pixmap, MapItemState state = MapItemState::AllState);
+
+    int addMarker(const QPointF &coords, int icon = 0, qreal heading = 0.); // QPointF(longitude, latitude)
+    QVector<int> addMarkers(const QVector<QPointF> &coords, int icon = 0);
+    void removeMarker(int id);
+    void clear();
+
+    bool contains(int id) const;
+    int count() const;
+
+    void setPosition(int id, const QPointF &coords);
+    void setPositions(const QVector<int> &ids, const QVector<QPointF> &coords,
+                      const QVector<qreal> &headings = QVector<qreal>());
+    QPointF position(int id) const;
+
+    void setHeading(int id, qreal heading); // degrees, clockwise
+    void setMarkerIcon(int id, int icon);
+    void setState(int id, MapItemState state);
+    MapItemState state(int id) const;
+
+    int markerAt(const QPointF &coords) const; // -1 if there is no marker
+    void updateCoords();
+
+    void setBoundingRect(const QRectF &rect);
+
+private:
+    QRectF boundingRect() const;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget);
+
+    struct MapMarkerLayerPrivate;
+    MapMarkerLayerPrivate * const d;
+};
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <QtConcurrentMap>
+#include <QVector>
+
+#include <cstdint>
+#include <cstring>
+
+//! \brief Branch-free double kernels for the batch projection loops.
+//! They use plain arithmetic, selects and bit operations only, so loops
+//! calling them are vectorized by the compiler. Domains and maximum error
+//! against libm: sin, cos |x| <= pi/2; exp |x| < 700; log for normal x > 0;
+//! atan for any finite x. See MapGlobal::toPoints() for the resulting bound.
+namespace MapMath
+{
+
+static const int ChunkSize = 32768; // items per thread in batch loops
+
+static const double Pi = 3.14159265358979323846;
+static const double PiHalf = 1.57079632679489661923;
+static const double PiQuarter = 0.78539816339744830962;
+static const double Sqrt2 = 1.41421356237309504880;
+static const double Ln2Hi = 6.93147180369123816490e-01;
+static const double Ln2Lo = 1.90821492927058770002e-10;
+static const double Log2e = 1.44269504088896338700e+00;
+static const double RoundMagic = 6755399441055744.0; // 1.5 * 2^52, rounds to integer
+static const double ExponentMagic = 4503599627370496.0; // 2^52
+
+inline std::uint64_t toBits(double x)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+inline double fromBits(std::uint64_t bits)
+{
+    double x;
+    std::memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+inline double round(double x)
+{
+    return (x + RoundMagic) - RoundMagic;
+}
+
+// Taylor series up to x^23, exact to double precision for |x| <= pi/2
+inline double sin(double x)
+{
+    const double z = x * x;
+    double p = -3.8681701706306840e-23;
+    p = p * z + 1.9572941063391263e-20;
+    p = p * z - 8.2206352466243300e-18;
+    p = p * z + 2.8114572543455206e-15;
+    p = p * z - 7.6471637318198160e-13;
+    p = p * z + 1.6059043836821613e-10;
+    p = p * z - 2.5052108385441720e-08;
+    p = p * z + 2.7557319223985893e-06;
+    p = p * z - 1.9841269841269841e-04;
+    p = p * z + 8.3333333333333333e-03;
+    p = p * z - 1.6666666666666666e-01;
+    return x + x * z * p;
+}
+
+// Taylor series up to x^24, exact to double precision for |x| <= pi/2
+inline double cos(double x)
+{
+    const double z = x * x;
+    double p = 1.6117375710961184e-24;
+    p = p * z - 8.8967913924505740e-22;
+    p = p * z + 4.1103176233121650e-19;
+    p = p * z - 1.5619206968586225e-16;
+    p = p * z + 4.7794773323873850e-14;
+    p = p * z - 1.1470745597729725e-11;
+    p = p * z + 2.0876756987868100e-09;
+    p = p * z - 2.7557319223985890e-07;
+    p = p * z + 2.4801587301587302e-05;
+    p = p * z - 1.3888888888888889e-03;
+    p = p * z + 4.1666666666666664e-02;
+    p = p * z - 0.5;
+    return 1. + z * p;
+}
+
+// x = k * ln2 + r, |r| <= ln2 / 2, Taylor series of exp(r) up to r^13
+inline double exp(double x)
+{
+    const double kr = x * Log2e + RoundMagic;
+    const double k = kr - RoundMagic;
+    const double r = (x - k * Ln2Hi) - k * Ln2Lo;
+
+    double p = 1.6059043836821613e-10;
+    p = p * r + 2.0876756987868100e-09;
+    p = p * r + 2.5052108385441720e-08;
+    p = p * r + 2.7557319223985890e-07;
+    p = p * r + 2.7557319223985893e-06;
+    p = p * r + 2.4801587301587302e-05;
+    p = p * r + 1.9841269841269841e-04;
+    p = p * r + 1.3888888888888889e-03;
+    p = p * r + 8.3333333333333333e-03;
+    p = p * r + 4.1666666666666664e-02;
+    p = p * r + 1.6666666666666666e-01;
+    p = p * r + 0.5;
+    p = p * r + 1.;
+    p = p * r + 1.;
+
+    // low bits of kr hold k as integer, move them into the exponent field
+    const std::uint64_t scale = (toBits(kr) + 1023) << 52;
+    return p * fromBits(scale);
+}
+
+// x = m * 2^e, sqrt(2)/2 <= m < sqrt(2), log(m) = 2 * atanh((m - 1) / (m + 1))
+inline double log(double x)
+{
+    const std::uint64_t bits = toBits(x);
+    std::uint64_t mantissa = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+
+    // positive doubles compare like integers, halve m above sqrt(2)
+    const std::uint64_t high = mantissa > 0x3ff6a09e667f3bcdULL;
+    mantissa -= high << 52;
+
+    const double m = fromBits(mantissa);
+    const double e = fromBits(((bits >> 52) + high) | 0x4330000000000000ULL) - ExponentMagic - 1023.;
+
+    const double s = (m - 1.) / (m + 1.);
+    const double z = s * s;
+    double p = 4.3478260869565216e-02;
+    p = p * z + 4.7619047619047616e-02;
+    p = p * z + 5.2631578947368421e-02;
+    p = p * z + 5.8823529411764705e-02;
+    p = p * z + 6.6666666666666667e-02;
+    p = p * z + 7.6923076923076927e-02;
+    p = p * z + 9.0909090909090912e-02;
+    p = p * z + 1.1111111111111111e-01;
+    p = p * z + 1.4285714285714285e-01;
+    p = p * z + 0.2;
+    p = p * z + 3.3333333333333333e-01;
+
+    return e * Ln2Hi + (2. * s + (2. * s * z * p + e * Ln2Lo));
+}
+
+inline double select(std::uint64_t mask, double a, double b)
+{
+    return fromBits((toBits(a) & mask) | (toBits(b) & ~mask));
+}
+
+// Cephes rational approximation with reduction to |x| <= 0.66
+inline double atan(double x)
+{
+    const std::uint64_t sign = toBits(x) & 0x8000000000000000ULL;
+    const double a = fromBits(toBits(x) ^ sign);
+
+    const std::uint64_t large = 0ULL - (toBits(a) > 0x4003504f333f9de6ULL);  // tan(3 * pi / 8)
+    const std::uint64_t middle = 0ULL - (toBits(a) > 0x3fe51eb851eb851fULL); // 0.66
+
+    const double r = select(large, -1. / a, select(middle, (a - 1.) / (a + 1.), a));
+    const double base = select(large, PiHalf, select(middle, PiQuarter, 0.));
+    const double more = select(large, 6.123233995736765886130e-17,
+                               select(middle, 3.061616997868382943065e-17, 0.));
+
+    const double z = r * r;
+    double p = -8.750608600031904122785e-01;
+    p = p * z - 1.615753718733365076637e+01;
+    p = p * z - 7.500855792314704667340e+01;
+    p = p * z - 1.228866684490136173410e+02;
+    p = p * z - 6.485021904942025371773e+01;
+
+    double q = z + 2.485846490142306297962e+01;
+    q = q * z + 1.650270098316988542046e+02;
+    q = q * z + 4.328810604912902668951e+02;
+    q = q * z + 4.853903996359136964868e+02;
+    q = q * z + 1.945506571482613964425e+02;
+
+    const double y = base + (r * z * p / q + r + more);
+    return fromBits(toBits(y) | sign);
+}
+
+// calls func(begin, end) over [0, count), split across threads for large counts
+template <typename Func>
+inline void parallelFor(int count, Func func)
+{
+    if (count < ChunkSize * 2)
+    {
+        func(0, count);
+        return;
+    }
+
+    QVector<int> chunks;
+    for (int i=0; i<count; i+=ChunkSize)
+        chunks.append(i);
+
+    QtConcurrent::blockingMap(chunks, [&](int &begin) {
+        func(begin, qMin(begin + ChunkSize, count));
+    });
+}
+
+} // namespace MapMath
@@ -0,0 +1,291 @@
+#include "mapoverlay.h"
+#include "mapspatialindex.h"
+#include "mapglobal.h"
+#include "mapitem.h"
+
+#include <QtConcurrentRun>
+#include <QFutureWatcher>
+#include <QPainter>
+#include <QTimer>
+#include <QCache>
+#include <QtMath>
+#include <QHash>
+#include <algorithm>
+
+struct OverlayShape
+{
+    QPainterPath path;
+    QPointF pos;
+    QPen pen;
+    QBrush brush;
+    qreal z;
+};
+
+struct OverlayEntry
+{
+    QRectF rect;
+    qreal margin;
+};
+
+static inline quint64 tileKey(int zoom, const QPoint &pos)
+{
+    return (static_cast<quint64>(zoom) << 56) |
+           (static_cast<quint64>(pos.x() & 0xfffffff) << 28) |
+            static_cast<quint64>(pos.y() & 0xfffffff);
+}
+
+static inline int tileZoom(quint64 key)
+{
+    return static_cast<int>(key >> 56);
+}
+
+static inline QPoint tilePos(quint64 key)
+{
+    return QPoint(static_cast<int>((key >> 28) & 0xfffffff), static_cast<int>(key & 0xfffffff));
+}
+
+static QImage renderTile(const QVector<OverlayShape> &shapes, const QRectF &rect, int size)
+{
+    QImage image(size, size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    const qreal scale = size / rect.width();
+
+    for (const OverlayShape &shape: shapes)
+    {
+        // offsets from the tile corner keep the precision of scene coordinates
+        const QPointF offset = shape.pos - rect.topLeft();
+
+        QTransform transform;
+        transform.scale(scale, scale);
+        transform.translate(offset.x(), offset.y());
+
+        painter.setTransform(transform);
+        painter.setPen(shape.pen);
+        painter.setBrush(shape.brush);
+        painter.drawPath(shape.path);
+    }
+
+    painter.end();
+    return image;
+}
+
+struct MapOverlay::MapOverlayPrivate
+{
+    MapGlobal &settings = MapGlobal::instance();
+    MapSpatialIndex *index = Q_NULLPTR;
+
+    QHash<MapItem*, OverlayEntry> entries;
+    QCache<quint64, QPixmap> tiles; // cost in kilobytes, null pixmaps for empty tiles
+    QHash<quint64, bool> pendingTiles; // true if items of the tile changed while rendering
+    QTimer invalidateTimer;
+
+    qreal factor(int zoom) const { return qPow(2., static_cast<qreal>(settings.zoomMax() - zoom)); }
+    QRectF tileRect(int zoom, const QPoint &pos) const;
+    bool intersects(quint64 key, const QRectF &rect, qreal margin) const;
+};
+
+QRectF MapOverlay::MapOverlayPrivate::tileRect(int zoom, const QPoint &pos) const
+{
+    const qreal width = settings.tileWidth() * factor(zoom);
+    return QRectF(pos.x() * width, pos.y() * width, width, width);
+}
+
+bool MapOverlay::MapOverlayPrivate::intersects(quint64 key, const QRectF &rect, qreal margin) const
+{
+    const int zoom = tileZoom(key);
+    const qreal indent = margin * factor(zoom);
+
+    return tileRect(zoom, tilePos(key)).intersects(rect.adjusted(-indent, -indent, indent, indent));
+}
+
+MapOverlay::MapOverlay(MapSpatialIndex *index, QObject *parent) : QObject(parent),
+    d(new MapOverlayPrivate)
+{
+    d->index = index;
+    d->tiles.setMaxCost(64 * 1024);
+
+    // many item changes in one event loop pass drop the view tiles once
+    d->invalidateTimer.setSingleShot(true);
+    d->invalidateTimer.setInterval(0);
+    connect(&d->invalidateTimer, &QTimer::timeout, this, &MapOverlay::invalidated);
+}
+
+MapOverlay::~MapOverlay()
+{
+    clear();
+    delete d;
+}
+
+void MapOverlay::setCacheSize(int kilobytes)
+{
+    d->tiles.setMaxCost(qMax(0, kilobytes));
+}
+
+int MapOverlay::cacheSize() const
+{
+    return d->tiles.maxCost();
+}
+
+void MapOverlay::insertItem(MapItem *item)
+{
+    item->setOverlay(this);
+    updateItem(item);
+}
+
+void MapOverlay::removeItem(MapItem *item)
+{
+    auto it = d->entries.find(item);
+
+    if (it != d->entries.end())
+    {
+        invalidate(it.value().rect, it.value().margin);
+        d->entries.erase(it);
+        item->setHiddenFlag(MapItem::Rasterized, false);
+    }
+
+    item->setOverlay(Q_NULLPTR);
+}
+
+void MapOverlay::updateItem(MapItem *item)
+{
+    auto it = d->entries.find(item);
+
+    if (it != d->entries.end())
+        invalidate(it.value().rect, it.value().margin);
+
+    if (!item->isStatic())
+    {
+        if (it == d->entries.end()) return;
+
+        d->entries.erase(it);
+        item->setHiddenFlag(MapItem::Rasterized, false);
+        return;
+    }
+
+    OverlayEntry entry;
+    item->indexGeometry(entry.rect, entry.margin);
+    d->entries.insert(item, entry);
+
+    item->setHiddenFlag(MapItem::Rasterized, true);
+    invalidate(entry.rect, entry.margin);
+}
+
+void MapOverlay::clear()
+{
+    for (auto it = d->entries.cbegin(); it != d->entries.cend(); ++it)
+    {
+        it.key()->setHiddenFlag(MapItem::Rasterized, false);
+        it.key()->setOverlay(Q_NULLPTR);
+    }
+
+    d->entries.clear();
+    d->tiles.clear();
+
+    for (auto it = d->pendingTiles.begin(); it != d->pendingTiles.end(); ++it)
+        it.value() = true;
+
+    d->invalidateTimer.start();
+}
+
+void MapOverlay::requestTile(const QPoint &pos)
+{
+    if (d->entries.isEmpty())
+    {
+        emit tileReady(pos, QPixmap());
+        return;
+    }
+
+    const int zoom = d->settings.zoom();
+    const quint64 key = tileKey(zoom, pos);
+
+    if (QPixmap *pix = d->tiles.object(key))
+    {
+        emit tileReady(pos, *pix);
+        return;
+    }
+
+    if (d->pendingTiles.contains(key)) return;
+
+    // paths are copied here, the worker does not touch the items
+    const QRectF rect = d->tileRect(zoom, pos);
+    const qreal factor = d->factor(zoom);
+    QVector<OverlayShape> shapes;
+
+    for (MapItem *item: d->index->items(rect, factor))
+    {
+        if (!d->entries.contains(item) || !item->isRasterized()) continue;
+
+        const MapStyle style = item->style();
+        QPen pen = style.pen();
+        pen.setCosmetic(true);
+
+        shapes.append({item->currentPath(), item->pos(), pen, style.brush(), item->zValue()});
+    }
+
+    if (shapes.isEmpty())
+    {
+        d->tiles.insert(key, new QPixmap, 1);
+        emit tileReady(pos, QPixmap());
+        return;
+    }
+
+    std::stable_sort(shapes.begin(), shapes.end(), [](const OverlayShape &a, const OverlayShape &b)
+    {
+        return a.z < b.z;
+    });
+
+    d->pendingTiles.insert(key, false);
+    const int size = d->settings.tileWidth();
+
+    QFutureWatcher<QImage> *watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, &QFutureWatcher<QImage>::finished, this, [=]()
+    {
+        onTileRendered(zoom, pos, watcher->result());
+        watcher->deleteLater();
+    });
+
+    watcher->setFuture(QtConcurrent::run(renderTile, shapes, rect, size));
+}
+
+// drops the cached tiles of the rect, tiles rendering there are rendered again
+void MapOverlay::invalidate(const QRectF &rect, qreal margin)
+{
+    const QList<quint64> keys = d->tiles.keys();
+    for (quint64 key: keys)
+    {
+        if (d->intersects(key, rect, margin))
+            d->tiles.remove(key);
+    }
+
+    for (auto it = d->pendingTiles.begin(); it != d->pendingTiles.end(); ++it)
+    {
+        if (!it.value() && d->intersects(it.key(), rect, margin))
+            it.value() = true;
+    }
+
+    d->invalidateTimer.start();
+}
+
+void MapOverlay::onTileRendered(int zoom, const QPoint &pos, const QImage &image)
+{
+    const quint64 key = tileKey(zoom, pos);
+    const bool isChanged = d->pendingTiles.take(key);
+
+    // items of the tile changed while rendering, the tile is rendered again
+    if (isChanged)
+    {
+        if (zoom == d->settings.zoom())
+            requestTile(pos);
+
+        return;
+    }
+
+    const QPixmap pix = QPixmap::fromImage(image);
+    d->tiles.insert(key, new QPixmap(pix), qMax(1, image.width() * image.height() * 4 / 1024));
+
+    if (zoom == d->settings.zoom())
+        emit tileReady(pos, pix);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QObject>
+#include <QPixmap>
+#include <QPoint>
+
+class MapItem;
+class MapSpatialIndex;
+
+//! \brief The MapOverlay class, draws static items into transparent tiles of
+//! the base map grid instead of the scene. Tiles are rendered per zoom on
+//! worker threads from a copy of the item paths, cached like base map tiles
+//! and composited by MapObject, so panning costs only blits. A change of an
+//! item drops the cached tiles it touches. Rasterized items are drawn in
+//! their default state and are found through MapView::findItemAt().
+class MapOverlay : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MapOverlay(MapSpatialIndex *index, QObject *parent = Q_NULLPTR);
+    ~MapOverlay();
+
+    void setCacheSize(int kilobytes);
+    int cacheSize() const;
+
+    void insertItem(MapItem *item);
+    void removeItem(MapItem *item);
+    void updateItem(MapItem *item);
+    void clear();
+
+public slots:
+    void requestTile(const QPoint &pos); // tile of the current zoom
+
+signals:
+    void tileReady(const QPoint &pos, const QPixmap &pix); // null if nothing is drawn there
+    void invalidated(); // tiles of the current view should be requested again
+
+private:
+    void invalidate(const QRectF &rect, qreal margin);
+    void onTileRendered(int zoom, const QPoint &pos, const QImage &image);
+
+    struct MapOverlayPrivate;
+    MapOverlayPrivate * const d;
+};
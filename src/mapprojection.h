@@ -0,0 +1,176 @@
+#pragma once
+
+#include "mapglobal.h"
+#include "mapmath.h"
+
+#include <QPointF>
+#include <cmath>
+
+//! \brief Projection policies between QPointF(longitude, latitude) and scene points.
+//! Each policy is a stateless type with constexpr constants, loops instantiated
+//! per policy have no runtime branch on CoordsTypes. Use dispatch() to pick the
+//! policy for a CoordsTypes value once, outside of the loop.
+namespace MapProjection
+{
+
+constexpr int TileWidth = 256;
+constexpr int ZoomMax = 23;
+constexpr int TilesCount = 1 << (ZoomMax - 1);
+constexpr double SceneWidth = static_cast<double>(TileWidth) * TilesCount;
+constexpr double Indent = TileWidth / 2.;
+constexpr double Pi = 3.14159265358979323846;
+constexpr double DegToRad = Pi / 180.;
+constexpr double RadToDeg = 180. / Pi;
+
+//! \brief Math backends, LibMath for single points, FastMath for vectorized batches
+struct LibMath
+{
+    static double sin(double x) { return std::sin(x); }
+    static double cos(double x) { return std::cos(x); }
+    static double exp(double x) { return std::exp(x); }
+    static double log(double x) { return std::log(x); }
+    static double atan(double x) { return std::atan(x); }
+};
+
+struct FastMath
+{
+    static double sin(double x) { return MapMath::sin(x); }
+    static double cos(double x) { return MapMath::cos(x); }
+    static double exp(double x) { return MapMath::exp(x); }
+    static double log(double x) { return MapMath::log(x); }
+    static double atan(double x) { return MapMath::atan(x); }
+};
+
+inline double toX(double lon)
+{
+    return (lon + 180.) * (SceneWidth / 360.) + Indent;
+}
+
+inline double toLon(double x)
+{
+    return (x - Indent) * (360. / SceneWidth) - 180.;
+}
+
+//! \brief Spherical Web Mercator, EPSG:3857
+struct WebMercator
+{
+    template <typename Math>
+    static double toY(double lat)
+    {
+        const double rLat = lat * DegToRad;
+        const double mercY = Math::log((1. + Math::sin(rLat)) / Math::cos(rLat));
+        return (0.5 - mercY / (2. * Pi)) * SceneWidth + Indent;
+    }
+
+    template <typename Math>
+    static double toLat(double y)
+    {
+        const double mercY = Pi - 2. * Pi * (y - Indent) / SceneWidth;
+        const double e = Math::exp(mercY);
+        return RadToDeg * Math::atan(0.5 * (e - 1. / e));
+    }
+};
+
+//! \brief Ellipsoidal World Mercator on WGS84, EPSG:3395
+struct WorldMercator
+{
+    static constexpr double E = 0.0818191908426215; // WGS84 eccentricity
+
+    // conformal to geodetic latitude series
+    static constexpr double C2 = 0.00335655146887969;
+    static constexpr double C4 = 0.00000657187271079536;
+    static constexpr double C6 = 0.00000001764564338702;
+    static constexpr double C8 = 0.00000000005328478445;
+
+    template <typename Math>
+    static double toY(double lat)
+    {
+        const double rLat = lat * DegToRad;
+        const double s = Math::sin(rLat);
+        const double mercY = Math::log((1. + s) / Math::cos(rLat)) -
+                E * 0.5 * Math::log((1. + E * s) / (1. - E * s));
+        return (0.5 - mercY / (2. * Pi)) * SceneWidth + Indent;
+    }
+
+    template <typename Math>
+    static double toLat(double y)
+    {
+        const double mercY = Pi - 2. * Pi * (y - Indent) / SceneWidth;
+        const double g = Pi / 2. - 2. * Math::atan(Math::exp(-mercY));
+
+        // sin(2g), sin(4g), sin(6g), sin(8g) from one sin/cos pair
+        const double sinG = Math::sin(g);
+        const double cosG = Math::cos(g);
+        const double sin2 = 2. * sinG * cosG;
+        const double cos2 = cosG * cosG - sinG * sinG;
+        const double sin4 = 2. * sin2 * cos2;
+        const double cos4 = cos2 * cos2 - sin2 * sin2;
+        const double sin6 = sin4 * cos2 + cos4 * sin2;
+        const double sin8 = 2. * sin4 * cos4;
+
+        return (g + C2 * sin2 + C4 * sin4 + C6 * sin6 + C8 * sin8) * RadToDeg;
+    }
+};
+
+//! \brief Plate carree, EPSG:4326, one degree has the same length on both axes,
+//! latitudes 90..-90 fill the upper half of the scene
+struct PlateCarree
+{
+    template <typename Math>
+    static double toY(double lat)
+    {
+        return (90. - lat) * (SceneWidth / 360.) + Indent;
+    }
+
+    template <typename Math>
+    static double toLat(double y)
+    {
+        return 90. - (y - Indent) * (360. / SceneWidth);
+    }
+};
+
+template <typename Projection, typename Math = LibMath>
+inline QPointF toPoint(const QPointF &coords)
+{
+    return QPointF(toX(coords.x()), Projection::template toY<Math>(coords.y()));
+}
+
+template <typename Projection, typename Math = LibMath>
+inline QPointF toCoords(const QPointF &point)
+{
+    return QPointF(toLon(point.x()), Projection::template toLat<Math>(point.y()));
+}
+
+template <typename Projection, typename Math = FastMath>
+inline void toPoints(const QPointF *coords, QPointF *points, int count)
+{
+    for (int i=0; i<count; ++i)
+    {
+        points[i].rx() = toX(coords[i].x());
+        points[i].ry() = Projection::template toY<Math>(coords[i].y());
+    }
+}
+
+template <typename Projection, typename Math = FastMath>
+inline void toCoords(const QPointF *points, QPointF *coords, int count)
+{
+    for (int i=0; i<count; ++i)
+    {
+        coords[i].rx() = toLon(points[i].x());
+        coords[i].ry() = Projection::template toLat<Math>(points[i].y());
+    }
+}
+
+// calls func(Projection()) with the policy matching type
+template <typename Func>
+inline auto dispatch(CoordsTypes type, Func func) -> decltype(func(WebMercator()))
+{
+    switch (type)
+    {
+    case Ellipsoidal: return func(WorldMercator());
+    case Equirectangular: return func(PlateCarree());
+    default: return func(WebMercator());
+    }
+}
+
+} // namespace MapProjection
@@ -0,0 +1,443 @@
+#include "maprenderer.h"
+#include "mapurltemplate.h"
+#include "mapprojection.h"
+
+#include <QNetworkAccessManager>
+#include <QtConcurrentRun>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QEventLoop>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QPainter>
+#include <QThread>
+#include <QCache>
+#include <QTimer>
+#include <QtMath>
+#include <QFile>
+#include <QDir>
+#include <QUrl>
+#include <algorithm>
+
+// decoded tiles are shared by all renderers, cost in kilobytes
+static QMutex tileCacheMutex;
+static QCache<QString, QImage> tileCache(100000); //100MB
+
+// the provider of a render, copied by each render from the renderer
+struct MapRenderer::RenderSettings
+{
+    QString providerName;
+    Provider provider;
+    MapUrlTemplate urlTemplate;
+    QString cachePath;
+
+    QPointF toPoint(const QPointF &coords) const
+    {
+        return MapProjection::dispatch(provider.coordsType, [&](auto projection) {
+            return MapProjection::toPoint<decltype(projection)>(coords);
+        });
+    }
+
+    QPointF toCoords(const QPointF &point) const
+    {
+        return MapProjection::dispatch(provider.coordsType, [&](auto projection) {
+            return MapProjection::toCoords<decltype(projection)>(point);
+        });
+    }
+};
+
+// items are not in a scene, renders paint copies of them at their own zoom
+// without the MapGlobal zoom and the pixmaps of the GUI thread
+struct MapRenderer::MapRendererPrivate
+{
+    QThreadPool pool;
+    QMutex itemsMutex;
+    mutable QMutex settingsMutex;
+    RenderSettings settings;
+    int timeout = 10000;
+
+    QVector<MapItem*> items;
+};
+
+static inline qreal zoomFactor(int zoom)
+{
+    return qPow(2., static_cast<qreal>(MapProjection::ZoomMax - zoom));
+}
+
+static int zoomToFit(const QRectF &rect, const QSize &size)
+{
+    for (int zoom = MapProjection::ZoomMax; zoom > 1; --zoom)
+    {
+        const qreal factor = zoomFactor(zoom);
+        if (rect.width() / factor <= size.width() && rect.height() / factor <= size.height())
+            return zoom;
+    }
+
+    return 1;
+}
+
+MapRenderer::MapRenderer(QObject *parent) : QObject(parent),
+    d(new MapRendererPrivate)
+{
+    d->pool.setMaxThreadCount(QThread::idealThreadCount());
+
+    // starts with the provider of the views
+    MapGlobal &settings = MapGlobal::instance();
+    setProvider(settings.providerName());
+    setCachePath(settings.cachePath());
+}
+
+MapRenderer::~MapRenderer()
+{
+    d->pool.waitForDone();
+    clearMap();
+
+    delete d;
+}
+
+bool MapRenderer::setProvider(const QString &provider)
+{
+    Provider value;
+    if (!MapGlobal::instance().findProvider(provider, value)) return false;
+
+    QMutexLocker locker(&d->settingsMutex);
+    d->settings.providerName = provider;
+    d->settings.provider = value;
+    d->settings.urlTemplate = MapUrlTemplate(value.url, value.subdomains, value.retina);
+
+    return true;
+}
+
+QString MapRenderer::provider() const
+{
+    QMutexLocker locker(&d->settingsMutex);
+    return d->settings.providerName;
+}
+
+void MapRenderer::setCachePath(const QString &path)
+{
+    QMutexLocker locker(&d->settingsMutex);
+    d->settings.cachePath = path;
+}
+
+QString MapRenderer::cachePath() const
+{
+    QMutexLocker locker(&d->settingsMutex);
+    return d->settings.cachePath;
+}
+
+void MapRenderer::setTimeout(int msec)
+{
+    d->timeout = msec;
+}
+
+int MapRenderer::timeout() const
+{
+    return d->timeout;
+}
+
+void MapRenderer::setMaxThreadCount(int count)
+{
+    d->pool.setMaxThreadCount(count);
+}
+
+int MapRenderer::maxThreadCount() const
+{
+    return d->pool.maxThreadCount();
+}
+
+MapItem *MapRenderer::createItem()
+{
+    QMutexLocker locker(&d->itemsMutex);
+
+    MapItem *item = new MapItem;
+    d->items.append(item);
+
+    return item;
+}
+
+void MapRenderer::removeItem(MapItem *item)
+{
+    QMutexLocker locker(&d->itemsMutex);
+
+    if (!d->items.contains(item)) return;
+
+    d->items.removeOne(item);
+    item->deleteLater();
+}
+
+void MapRenderer::clearMap()
+{
+    QMutexLocker locker(&d->itemsMutex);
+
+    foreach (MapItem *item, d->items)
+        item->deleteLater();
+
+    d->items.clear();
+}
+
+QImage MapRenderer::render(const QPointF &center, int zoom, const QSize &size)
+{
+    const RenderSettings settings = this->settings();
+    zoom = qBound(1, zoom, MapProjection::ZoomMax);
+
+    return render(settings, snapshot(settings, zoom), center, zoom, size);
+}
+
+QImage MapRenderer::render(const QPointF &boundLeftTop, const QPointF &boundRightBottom, const QSize &size)
+{
+    const RenderSettings settings = this->settings();
+    const QRectF rect = QRectF(settings.toPoint(boundLeftTop), settings.toPoint(boundRightBottom)).normalized();
+    const int zoom = zoomToFit(rect, size);
+
+    return render(settings, snapshot(settings, zoom), settings.toCoords(rect.center()), zoom, size);
+}
+
+QFuture<QImage> MapRenderer::renderAsync(const QPointF &center, int zoom, const QSize &size)
+{
+    const RenderSettings settings = this->settings();
+    zoom = qBound(1, zoom, MapProjection::ZoomMax);
+    const QVector<MapItemSnapshot> items = snapshot(settings, zoom);
+
+    return QtConcurrent::run(&d->pool, [=]() { return render(settings, items, center, zoom, size); });
+}
+
+QFuture<QImage> MapRenderer::renderAsync(const QPointF &boundLeftTop, const QPointF &boundRightBottom, const QSize &size)
+{
+    const RenderSettings settings = this->settings();
+    const QRectF rect = QRectF(settings.toPoint(boundLeftTop), settings.toPoint(boundRightBottom)).normalized();
+    const QPointF center = settings.toCoords(rect.center());
+    const int zoom = zoomToFit(rect, size);
+    const QVector<MapItemSnapshot> items = snapshot(settings, zoom);
+
+    return QtConcurrent::run(&d->pool, [=]() { return render(settings, items, center, zoom, size); });
+}
+
+int MapRenderer::fitZoom(const QPointF &boundLeftTop, const QPointF &boundRightBottom, const QSize &size)
+{
+    MapGlobal &settings = MapGlobal::instance();
+    return zoomToFit(QRectF(settings.toPoint(boundLeftTop), settings.toPoint(boundRightBottom)).normalized(), size);
+}
+
+MapRenderer::RenderSettings MapRenderer::settings() const
+{
+    QMutexLocker locker(&d->settingsMutex);
+    return d->settings;
+}
+
+// items are copied in the calling thread, workers do not touch them
+QVector<MapItemSnapshot> MapRenderer::snapshot(const RenderSettings &settings, int zoom)
+{
+    QMutexLocker locker(&d->itemsMutex);
+
+    const qreal factor = zoomFactor(zoom);
+    QVector<MapItemSnapshot> items;
+    items.reserve(d->items.size());
+
+    for (const MapItem *item: qAsConst(d->items))
+    {
+        if (item->isVisible())
+            items.append(item->snapshot(settings.provider.coordsType, factor));
+    }
+
+    return items;
+}
+
+QImage MapRenderer::render(const RenderSettings &settings, const QVector<MapItemSnapshot> &items,
+                           const QPointF &center, int zoom, const QSize &size)
+{
+    const qreal factor = zoomFactor(zoom);
+    const QPointF centerPoint = settings.toPoint(center);
+    const QRectF sceneRect(centerPoint.x() - size.width() * factor / 2.,
+                           centerPoint.y() - size.height() * factor / 2.,
+                           size.width() * factor, size.height() * factor);
+
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(QColor(Qt::lightGray));
+
+    QPainter painter(&image);
+    drawTiles(&painter, settings, sceneRect, zoom);
+    drawItems(&painter, settings, items, sceneRect, zoom);
+    painter.end();
+
+    return image;
+}
+
+void MapRenderer::drawTiles(QPainter *painter, const RenderSettings &settings, const QRectF &sceneRect, int zoom)
+{
+    const qreal factor = zoomFactor(zoom);
+    const qreal tileWidth = static_cast<qreal>(MapProjection::TileWidth) * factor;
+    const int tilesCount = 1 << (zoom - 1);
+
+    const int left = qMax(0, qFloor(sceneRect.left() / tileWidth));
+    const int top = qMax(0, qFloor(sceneRect.top() / tileWidth));
+    const int right = qMin(tilesCount - 1, qFloor(sceneRect.right() / tileWidth));
+    const int bottom = qMin(tilesCount - 1, qFloor(sceneRect.bottom() / tileWidth));
+
+    QVector<QPoint> positions;
+    for (int i=left; i<=right; ++i)
+        for (int j=top; j<=bottom; ++j)
+            positions.append(QPoint(i, j));
+
+    QVector<QImage> images(positions.size());
+    fetchTiles(settings, positions, zoom, images);
+
+    painter->setRenderHint(QPainter::SmoothPixmapTransform);
+
+    for (int i=0; i<positions.size(); ++i)
+    {
+        if (images.at(i).isNull()) continue;
+
+        const QPoint &pos = positions.at(i);
+        const QRectF rect((pos.x() * tileWidth - sceneRect.x()) / factor,
+                          (pos.y() * tileWidth - sceneRect.y()) / factor,
+                          MapProjection::TileWidth, MapProjection::TileWidth);
+
+        painter->drawImage(rect, images.at(i));
+    }
+}
+
+// the snapshots are copies of this render, they are projected here
+void MapRenderer::drawItems(QPainter *painter, const RenderSettings &settings, QVector<MapItemSnapshot> items,
+                            const QRectF &sceneRect, int zoom)
+{
+    const qreal factor = zoomFactor(zoom);
+    QVector<const MapItemSnapshot*> visible;
+
+    for (MapItemSnapshot &item: items)
+    {
+        MapItem::projectSnapshot(item, settings.provider.coordsType);
+
+        const QRectF rect = item.path.isEmpty() ? QRectF(item.origin, QSizeF(0., 0.))
+                                                : item.path.boundingRect().translated(item.origin);
+        const qreal margin = item.margin * factor;
+
+        if (rect.left() - margin <= sceneRect.right() && rect.right() + margin >= sceneRect.left() &&
+            rect.top() - margin <= sceneRect.bottom() && rect.bottom() + margin >= sceneRect.top())
+            visible.append(&item);
+    }
+
+    // in the order of the scene, by z and then by insertion
+    std::stable_sort(visible.begin(), visible.end(), [](const MapItemSnapshot *a, const MapItemSnapshot *b)
+    {
+        return a->zValue < b->zValue;
+    });
+
+    painter->setRenderHint(QPainter::Antialiasing);
+
+    for (const MapItemSnapshot *item: qAsConst(visible))
+    {
+        painter->save();
+        painter->translate((item->origin - sceneRect.topLeft()) / factor);
+        MapItem::render(painter, *item, factor);
+        painter->restore();
+    }
+}
+
+void MapRenderer::fetchTiles(const RenderSettings &settings, const QVector<QPoint> &positions, int zoom, QVector<QImage> &images)
+{
+    const QString &suffix = settings.provider.cachePathSuffix;
+    QVector<int> missing;
+
+    for (int i=0; i<positions.size(); ++i)
+    {
+        if (!findTile(settings, MapGlobal::tileCachePath(suffix, positions.at(i), zoom), images[i]))
+            missing.append(i);
+    }
+
+    if (missing.isEmpty() || settings.providerName.isEmpty()) return;
+
+    QNetworkAccessManager manager;
+    QEventLoop loop;
+    int pending = missing.size();
+
+    foreach (int index, missing)
+    {
+        const QPoint &pos = positions.at(index);
+
+        QString url;
+        if (settings.provider.calcUrlFunc)
+        {
+            url = settings.provider.url;
+            settings.provider.calcUrlFunc(pos.x(), pos.y(), zoom - 1, url);
+        }
+        else settings.urlTemplate.format(pos.x(), pos.y(), zoom - 1, url);
+
+        QNetworkRequest request = QNetworkRequest(QUrl(url));
+        request.setRawHeader("User-Agent", "Mozilla/5.0 (PC; U; Intel; Linux; en) AppleWebKit/420+ (KHTML, like Gecko)");
+
+        QNetworkReply *reply = manager.get(request);
+        connect(reply, &QNetworkReply::finished, &loop, [&, reply, index]()
+        {
+            if (reply->error() == QNetworkReply::NoError)
+            {
+                const QByteArray data = reply->readAll();
+                QImage image;
+
+                if (image.loadFromData(data))
+                {
+                    insertTile(settings, MapGlobal::tileCachePath(suffix, positions.at(index), zoom), image, data);
+                    images[index] = image;
+                }
+            }
+
+            reply->deleteLater();
+
+            if (--pending == 0)
+                loop.quit();
+        });
+    }
+
+    QTimer::singleShot(d->timeout, &loop, &QEventLoop::quit);
+    loop.exec();
+}
+
+bool MapRenderer::findTile(const RenderSettings &settings, const QString &path, QImage &image)
+{
+    {
+        QMutexLocker locker(&tileCacheMutex);
+        if (QImage *cached = tileCache.object(path))
+        {
+            image = *cached;
+            return true;
+        }
+    }
+
+    if (settings.cachePath.isEmpty()) return false;
+
+    QFile file(settings.cachePath + path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    if (!image.loadFromData(file.readAll())) return false;
+
+    QMutexLocker locker(&tileCacheMutex);
+    tileCache.insert(path, new QImage(image), image.bytesPerLine() * image.height() / 1024);
+
+    return true;
+}
+
+void MapRenderer::insertTile(const RenderSettings &settings, const QString &path, const QImage &image, const QByteArray &data)
+{
+    {
+        QMutexLocker locker(&tileCacheMutex);
+        tileCache.insert(path, new QImage(image), image.bytesPerLine() * image.height() / 1024);
+    }
+
+    if (settings.cachePath.isEmpty()) return;
+
+    QFileInfo fInfo(settings.cachePath + path);
+    if (!fInfo.dir().exists())
+    {
+        QDir dir = fInfo.dir();
+        dir.mkpath(".");
+    }
+
+    // renders may fetch the same tile concurrently
+    QSaveFile file(fInfo.filePath());
+    if (!file.open(QIODevice::WriteOnly)) return;
+
+    file.write(data);
+    file.commit();
+}
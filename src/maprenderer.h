@@ -0,0 +1,63 @@
+#pragma once
+
+#include "mapitem.h"
+#include "mapglobal.h"
+
+#include <QObject>
+#include <QFuture>
+#include <QImage>
+
+//! \brief The MapRenderer class renders tiles and items to QImage without a widget.
+//! The renderer has its own provider and cache path, MapGlobal and the views
+//! are not changed. Items are copied in the calling thread, call render() and
+//! renderAsync() from the thread of the items.
+class MapRenderer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MapRenderer(QObject *parent = Q_NULLPTR);
+    ~MapRenderer();
+
+    bool setProvider(const QString &provider); // one of the MapGlobal providers
+    QString provider() const;
+
+    void setCachePath(const QString &path);
+    QString cachePath() const;
+
+    void setTimeout(int msec); // network timeout for one render
+    int timeout() const;
+
+    void setMaxThreadCount(int count);
+    int maxThreadCount() const;
+
+    MapItem *createItem();
+    void removeItem(MapItem *item);
+    void clearMap();
+
+    QImage render(const QPointF &center, int zoom, const QSize &size); // QPointF(longitude, latitude)
+    QImage render(const QPointF &boundLeftTop, const QPointF &boundRightBottom, const QSize &size);
+
+    QFuture<QImage> renderAsync(const QPointF &center, int zoom, const QSize &size);
+    QFuture<QImage> renderAsync(const QPointF &boundLeftTop, const QPointF &boundRightBottom, const QSize &size);
+
+    static int fitZoom(const QPointF &boundLeftTop, const QPointF &boundRightBottom, const QSize &size);
+
+private:
+    struct RenderSettings;
+
+    QImage render(const RenderSettings &settings, const QVector<MapItemSnapshot> &items,
+                  const QPointF &center, int zoom, const QSize &size);
+    QVector<MapItemSnapshot> snapshot(const RenderSettings &settings, int zoom);
+    RenderSettings settings() const;
+
+    void drawTiles(QPainter *painter, const RenderSettings &settings, const QRectF &sceneRect, int zoom);
+    void drawItems(QPainter *painter, const RenderSettings &settings, QVector<MapItemSnapshot> items,
+                   const QRectF &sceneRect, int zoom);
+    void fetchTiles(const RenderSettings &settings, const QVector<QPoint> &positions, int zoom, QVector<QImage> &images);
+
+    bool findTile(const RenderSettings &settings, const QString &path, QImage &image);
+    void insertTile(const RenderSettings &settings, const QString &path, const QImage &image, const QByteArray &data);
+
+    struct MapRendererPrivate;
+    MapRendererPrivate * const d;
+};
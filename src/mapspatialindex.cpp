@@ -0,0 +1,308 @@
+#include "mapspatialindex.h"
+#include "mapprojection.h"
+#include "mapitem.h"
+
+#include <QtMath>
+#include <QHash>
+#include <QSet>
+
+// cells from the whole scene down to 2^16 scene units
+static const int LEVELS_COUNT = 15;
+
+struct IndexEntry
+{
+    QRectF rect;        // part of the item that scales with the map
+    qreal margin = 0.;  // pixels around rect that keep their size on screen
+    int level = 0;
+    quint64 cell = 0;
+    int slot = 0;       // position in the cell
+};
+
+static inline quint64 cellKey(qint64 x, qint64 y)
+{
+    return (static_cast<quint64>(static_cast<quint32>(x)) << 32) | static_cast<quint32>(y);
+}
+
+static inline qreal cellSize(int level)
+{
+    return MapProjection::SceneWidth / static_cast<qreal>(1 << level);
+}
+
+static inline bool intersects(const IndexEntry &entry, const QRectF &rect, qreal factor)
+{
+    // QRectF::intersects() is false for empty rects, points are valid here
+    const qreal margin = entry.margin * factor;
+    return entry.rect.left() - margin <= rect.right() && entry.rect.right() + margin >= rect.left() &&
+           entry.rect.top() - margin <= rect.bottom() && entry.rect.bottom() + margin >= rect.top();
+}
+
+struct MapSpatialIndex::MapSpatialIndexPrivate
+{
+    QHash<MapItem*, IndexEntry> entries;
+    QHash<quint64, QVector<MapItem*>> cells[LEVELS_COUNT];
+    qreal maxMargin = 0.;
+
+    bool hasViewport = false;
+    QRectF viewport;
+    qreal factor = 1.;
+    QSet<MapItem*> visible;
+
+    IndexEntry createEntry(MapItem *item);
+    void insertEntry(MapItem *item, IndexEntry &entry);
+    void removeEntry(const IndexEntry &entry);
+    void updateVisibility(MapItem *item, const IndexEntry &entry);
+};
+
+IndexEntry MapSpatialIndex::MapSpatialIndexPrivate::createEntry(MapItem *item)
+{
+    IndexEntry entry;
+    item->indexGeometry(entry.rect, entry.margin);
+    maxMargin = qMax(maxMargin, entry.margin);
+
+    // loose cells: an item is not bigger than its cell, so it stays within
+    // half a cell around the cell holding its center
+    const qreal size = qMax(entry.rect.width(), entry.rect.height());
+    entry.level = LEVELS_COUNT - 1;
+
+    while (entry.level > 0 && cellSize(entry.level) < size)
+        --entry.level;
+
+    const QPointF center = entry.rect.center();
+    const qreal width = cellSize(entry.level);
+    entry.cell = cellKey(qFloor(center.x() / width), qFloor(center.y() / width));
+
+    return entry;
+}
+
+void MapSpatialIndex::MapSpatialIndexPrivate::insertEntry(MapItem *item, IndexEntry &entry)
+{
+    QVector<MapItem*> &cell = cells[entry.level][entry.cell];
+    entry.slot = cell.size();
+    cell.append(item);
+}
+
+void MapSpatialIndex::MapSpatialIndexPrivate::removeEntry(const IndexEntry &entry)
+{
+    auto it = cells[entry.level].find(entry.cell);
+    if (it == cells[entry.level].end()) return;
+
+    QVector<MapItem*> &cell = it.value();
+    MapItem *last = cell.last();
+    cell[entry.slot] = last;
+    entries[last].slot = entry.slot;
+    cell.removeLast();
+
+    if (cell.isEmpty())
+        cells[entry.level].erase(it);
+}
+
+void MapSpatialIndex::MapSpatialIndexPrivate::updateVisibility(MapItem *item, const IndexEntry &entry)
+{
+    if (!hasViewport) return;
+
+    const bool isVisible = intersects(entry, viewport, factor);
+    if (isVisible == visible.contains(item)) return;
+
+    if (isVisible) visible.insert(item);
+    else visible.remove(item);
+
+    item->setHiddenFlag(MapItem::Culled, !isVisible);
+}
+
+MapSpatialIndex::MapSpatialIndex() :
+    d(new MapSpatialIndexPrivate)
+{
+}
+
+MapSpatialIndex::~MapSpatialIndex()
+{
+    clear();
+    delete d;
+}
+
+void MapSpatialIndex::insert(MapItem *item)
+{
+    if (d->entries.contains(item)) return;
+
+    IndexEntry entry = d->createEntry(item);
+    d->insertEntry(item, entry);
+    d->entries.insert(item, entry);
+
+    item->setIndex(this);
+    item->setHiddenFlag(MapItem::Culled, d->hasViewport);
+    d->updateVisibility(item, entry);
+}
+
+void MapSpatialIndex::insert(const QVector<MapItem*> &items)
+{
+    d->entries.reserve(d->entries.size() + items.size());
+
+    for (MapItem *item: items)
+        insert(item);
+}
+
+void MapSpatialIndex::remove(MapItem *item)
+{
+    auto it = d->entries.find(item);
+    if (it == d->entries.end()) return;
+
+    d->removeEntry(it.value());
+    d->entries.erase(it);
+    d->visible.remove(item);
+
+    item->setIndex(Q_NULLPTR);
+    item->setHiddenFlag(MapItem::Culled, false);
+}
+
+void MapSpatialIndex::update(MapItem *item)
+{
+    auto it = d->entries.find(item);
+    if (it == d->entries.end()) return;
+
+    d->removeEntry(it.value());
+
+    IndexEntry entry = d->createEntry(item);
+    d->insertEntry(item, entry);
+    it.value() = entry;
+
+    d->updateVisibility(item, entry);
+}
+
+void MapSpatialIndex::update(const QVector<MapItem*> &items)
+{
+    for (MapItem *item: items)
+        update(item);
+}
+
+void MapSpatialIndex::clear()
+{
+    for (auto it = d->entries.cbegin(); it != d->entries.cend(); ++it)
+    {
+        it.key()->setIndex(Q_NULLPTR);
+        it.key()->setHiddenFlag(MapItem::Culled, false);
+    }
+
+    d->entries.clear();
+    d->visible.clear();
+    d->maxMargin = 0.;
+
+    for (int i=0; i<LEVELS_COUNT; ++i)
+        d->cells[i].clear();
+}
+
+bool MapSpatialIndex::contains(MapItem *item) const
+{
+    return d->entries.contains(item);
+}
+
+int MapSpatialIndex::count() const
+{
+    return d->entries.size();
+}
+
+QVector<MapItem*> MapSpatialIndex::items(const QRectF &rect, qreal factor) const
+{
+    QVector<MapItem*> result;
+    const qreal margin = d->maxMargin * factor;
+
+    for (int level=0; level<LEVELS_COUNT; ++level)
+    {
+        const QHash<quint64, QVector<MapItem*>> &cells = d->cells[level];
+        if (cells.isEmpty()) continue;
+
+        const qreal width = cellSize(level);
+        const qreal indent = width / 2. + margin;
+        const qint64 left = qFloor((rect.left() - indent) / width);
+        const qint64 right = qFloor((rect.right() + indent) / width);
+        const qint64 top = qFloor((rect.top() - indent) / width);
+        const qint64 bottom = qFloor((rect.bottom() + indent) / width);
+
+        auto collect = [&](const QVector<MapItem*> &cell) {
+            for (MapItem *item: cell)
+                if (intersects(d->entries.value(item), rect, factor))
+                    result.append(item);
+        };
+
+        // the top level may hold items bigger than the scene
+        if (level == 0 || (right - left + 1) * (bottom - top + 1) > cells.size())
+        {
+            for (auto it = cells.cbegin(); it != cells.cend(); ++it)
+                collect(it.value());
+
+            continue;
+        }
+
+        for (qint64 x=left; x<=right; ++x)
+        {
+            for (qint64 y=top; y<=bottom; ++y)
+            {
+                auto it = cells.constFind(cellKey(x, y));
+                if (it != cells.cend()) collect(it.value());
+            }
+        }
+    }
+
+    return result;
+}
+
+MapItem *MapSpatialIndex::itemAt(const QPointF &point, qreal factor) const
+{
+    MapItem *result = Q_NULLPTR;
+
+    for (MapItem *item: items(QRectF(point, point), factor))
+    {
+        if (!(item->isShown() || item->isRasterized()) || !item->hitTest(point)) continue;
+
+        if (!result || item->zValue() >= result->zValue())
+            result = item;
+    }
+
+    return result;
+}
+
+int MapSpatialIndex::visibleCount() const
+{
+    return d->hasViewport ? d->visible.size() : d->entries.size();
+}
+
+void MapSpatialIndex::setViewport(const QRectF &rect, qreal factor)
+{
+    const QVector<MapItem*> items = this->items(rect, factor);
+    QSet<MapItem*> visible;
+    visible.reserve(items.size());
+
+    for (MapItem *item: items)
+    {
+        visible.insert(item);
+
+        if (!d->hasViewport || !d->visible.contains(item))
+            item->setHiddenFlag(MapItem::Culled, false);
+    }
+
+    if (d->hasViewport)
+    {
+        for (MapItem *item: qAsConst(d->visible))
+            if (!visible.contains(item))
+                item->setHiddenFlag(MapItem::Culled, true);
+    }
+    else
+    {
+        for (auto it = d->entries.cbegin(); it != d->entries.cend(); ++it)
+            if (!visible.contains(it.key()))
+                it.key()->setHiddenFlag(MapItem::Culled, true);
+    }
+
+    d->hasViewport = true;
+    d->viewport = rect;
+    d->factor = factor;
+    d->visible.swap(visible);
+}
+
+void MapSpatialIndex::resetViewport()
+{
+    for (auto it = d->entries.cbegin(); it != d->entries.cend(); ++it)
+        it.key()->setHiddenFlag(MapItem::Culled, false);
+
+    d->hasViewport = false;
+    d->visible.clear();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QVector>
+#include <QRectF>
+
+class MapItem;
+
+//! \brief The MapSpatialIndex class, loose hierarchical grid over the scene.
+//! An item lives in one cell of the deepest level whose cell is not smaller
+//! than the item, so insert, update and remove are O(1). Parts of items that
+//! keep their size on screen (pixmaps, pens) are accounted by a margin in
+//! pixels, queries take the current MapGlobal::factor() for it.
+//! With a viewport set, items outside of it are not painted.
+class MapSpatialIndex
+{
+public:
+    MapSpatialIndex();
+    ~MapSpatialIndex();
+
+    void insert(MapItem *item);
+    void insert(const QVector<MapItem*> &items);
+    void remove(MapItem *item);
+    void update(MapItem *item);
+    void update(const QVector<MapItem*> &items);
+    void clear();
+
+    bool contains(MapItem *item) const;
+    int count() const;
+    int visibleCount() const; // in the viewport, all items without it
+
+    QVector<MapItem*> items(const QRectF &rect, qreal factor) const;
+    MapItem *itemAt(const QPointF &point, qreal factor) const;
+
+    void setViewport(const QRectF &rect, qreal factor);
+    void resetViewport();
+
+private:
+    struct MapSpatialIndexPrivate;
+    MapSpatialIndexPrivate * const d;
+};
@@ -0,0 +1,211 @@
+#include "mapstyle.h"
+#include "mapitem.h"
+
+static const int STATES_COUNT = 3;
+
+struct MapStyleData : public QSharedData
+{
+    QPen pens[STATES_COUNT];
+    QBrush brushes[STATES_COUNT];
+    QBrush maskBrushes[STATES_COUNT];
+    QColor colors[STATES_COUNT];
+    QFont font = QFont("mono", 12, QFont::Medium);
+
+    MapStyleData()
+    {
+        for (int i=0; i<STATES_COUNT; ++i)
+        {
+            pens[i] = QPen(QBrush(QColor(Qt::black)), 1);
+            brushes[i] = QBrush(QColor(0, 0, 0, 0));
+            maskBrushes[i] = QBrush(Qt::NoBrush);
+            colors[i] = QColor(Qt::black);
+        }
+    }
+};
+
+static const QSharedDataPointer<MapStyleData> &defaultData()
+{
+    static const QSharedDataPointer<MapStyleData> data(new MapStyleData);
+    return data;
+}
+
+// calls func(index) for the states array indexes matching state
+template <typename Func>
+static void forStates(MapItemState state, Func func)
+{
+    if (state == MapItemState::AllState)
+    {
+        for (int i=0; i<STATES_COUNT; ++i)
+            func(i);
+    }
+    else func(static_cast<int>(state));
+}
+
+static inline int stateIndex(MapItemState state)
+{
+    return state == MapItemState::AllState ? 0 : static_cast<int>(state);
+}
+
+MapStyle::MapStyle() :
+    d(defaultData())
+{
+}
+
+MapStyle::MapStyle(const MapStyle &other) :
+    d(other.d)
+{
+}
+
+MapStyle &MapStyle::operator=(const MapStyle &other)
+{
+    d = other.d;
+    return *this;
+}
+
+MapStyle::~MapStyle()
+{
+}
+
+const QPen &MapStyle::pen(MapItemState state) const
+{
+    return d->pens[stateIndex(state)];
+}
+
+const QBrush &MapStyle::brush(MapItemState state) const
+{
+    return d->brushes[stateIndex(state)];
+}
+
+const QBrush &MapStyle::maskBrush(MapItemState state) const
+{
+    return d->maskBrushes[stateIndex(state)];
+}
+
+const QColor &MapStyle::color(MapItemState state) const
+{
+    return d->colors[stateIndex(state)];
+}
+
+const QFont &MapStyle::font() const
+{
+    return d->font;
+}
+
+MapStyle MapStyle::withPen(const QPen &pen, MapItemState state) const
+{
+    MapStyle style(*this);
+    forStates(state, [&](int i) { style.d->pens[i] = pen; });
+    return style;
+}
+
+MapStyle MapStyle::withBrush(const QBrush &brush, MapItemState state) const
+{
+    MapStyle style(*this);
+    forStates(state, [&](int i) { style.d->brushes[i] = brush; });
+    return style;
+}
+
+MapStyle MapStyle::withMaskBrush(const QBrush &brush, MapItemState state) const
+{
+    MapStyle style(*this);
+    forStates(state, [&](int i) { style.d->maskBrushes[i] = brush; });
+    return style;
+}
+
+MapStyle MapStyle::withColor(const QColor &color, MapItemState state) const
+{
+    MapStyle style(*this);
+    forStates(state, [&](int i) { style.d->colors[i] = color; });
+    return style;
+}
+
+MapStyle MapStyle::withFont(const QFont &font) const
+{
+    MapStyle style(*this);
+    style.d->font = font;
+    return style;
+}
+
+bool MapStyle::operator==(const MapStyle &other) const
+{
+    if (d.constData() == other.d.constData()) return true;
+
+    for (int i=0; i<STATES_COUNT; ++i)
+    {
+        if (d->pens[i] != other.d->pens[i] || d->brushes[i] != other.d->brushes[i] ||
+            d->maskBrushes[i] != other.d->maskBrushes[i] || d->colors[i] != other.d->colors[i])
+            return false;
+    }
+
+    return d->font == other.d->font;
+}
+
+bool MapStyle::operator!=(const MapStyle &other) const
+{
+    return !(*this == other);
+}
+
+/*********************** MapStyleRegistry ***********************/
+struct MapStyleRegistry::MapStyleRegistryPrivate
+{
+    QVector<MapStyle> styles;
+    QHash<int, QSet<MapItem*>> items;
+};
+
+MapStyleRegistry &MapStyleRegistry::instance()
+{
+    static MapStyleRegistry registry;
+    return registry;
+}
+
+MapStyleRegistry::MapStyleRegistry() :
+    d(new MapStyleRegistryPrivate)
+{
+}
+
+MapStyleRegistry::~MapStyleRegistry()
+{
+    delete d;
+}
+
+int MapStyleRegistry::addStyle(const MapStyle &style)
+{
+    d->styles.append(style);
+    return d->styles.size() - 1;
+}
+
+void MapStyleRegistry::setStyle(int handle, const MapStyle &style)
+{
+    if (!contains(handle)) return;
+
+    d->styles[handle] = style;
+
+    for (MapItem *item: d->items.value(handle))
+        item->applyStyle(style);
+
+    emit styleChanged(handle);
+}
+
+MapStyle MapStyleRegistry::style(int handle) const
+{
+    return contains(handle) ? d->styles.at(handle) : MapStyle();
+}
+
+bool MapStyleRegistry::contains(int handle) const
+{
+    return handle >= 0 && handle < d->styles.size();
+}
+
+void MapStyleRegistry::attach(int handle, MapItem *item)
+{
+    d->items[handle].insert(item);
+}
+
+void MapStyleRegistry::detach(int handle, MapItem *item)
+{
+    auto it = d->items.find(handle);
+    if (it == d->items.end()) return;
+
+    it.value().remove(item);
+    if (it.value().isEmpty()) d->items.erase(it);
+}
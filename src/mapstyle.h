@@ -0,0 +1,81 @@
+#pragma once
+
+#include <QSharedDataPointer>
+#include <QObject>
+#include <QBrush>
+#include <QColor>
+#include <QFont>
+#include <QHash>
+#include <QPen>
+#include <QSet>
+
+enum class MapItemState
+{
+    Default = 0,
+    Hovered,
+    Selected,
+    AllState
+};
+
+class MapItem;
+struct MapStyleData;
+
+//! \brief The MapStyle class, immutable pens, brushes, mask brushes, font and
+//! text colors per MapItemState. Copies share one data block, with*() return
+//! a modified copy. Default constructed styles share a single block.
+class MapStyle
+{
+public:
+    MapStyle();
+    MapStyle(const MapStyle &other);
+    MapStyle &operator=(const MapStyle &other);
+    ~MapStyle();
+
+    const QPen &pen(MapItemState state = MapItemState::Default) const;
+    const QBrush &brush(MapItemState state = MapItemState::Default) const;
+    const QBrush &maskBrush(MapItemState state = MapItemState::Default) const;
+    const QColor &color(MapItemState state = MapItemState::Default) const; // text color
+    const QFont &font() const;
+
+    MapStyle withPen(const QPen &pen, MapItemState state = MapItemState::AllState) const;
+    MapStyle withBrush(const QBrush &brush, MapItemState state = MapItemState::AllState) const;
+    MapStyle withMaskBrush(const QBrush &brush, MapItemState state = MapItemState::AllState) const;
+    MapStyle withColor(const QColor &color, MapItemState state = MapItemState::AllState) const;
+    MapStyle withFont(const QFont &font) const;
+
+    bool operator==(const MapStyle &other) const;
+    bool operator!=(const MapStyle &other) const;
+
+private:
+    QSharedDataPointer<MapStyleData> d;
+};
+
+//! \brief The MapStyleRegistry class, styles shared by handle. Items set with
+//! MapItem::setStyle(int) follow setStyle() of their handle, so a whole class
+//! of items is restyled in one call. Used from the GUI thread.
+class MapStyleRegistry : public QObject
+{
+    Q_OBJECT
+public:
+    static MapStyleRegistry &instance();
+
+    int addStyle(const MapStyle &style);
+    void setStyle(int handle, const MapStyle &style);
+    MapStyle style(int handle) const;
+    bool contains(int handle) const;
+
+signals:
+    void styleChanged(int handle);
+
+private:
+    MapStyleRegistry();
+    ~MapStyleRegistry();
+
+    void attach(int handle, MapItem *item);
+    void detach(int handle, MapItem *item);
+
+    friend class MapItem;
+
+    struct MapStyleRegistryPrivate;
+    MapStyleRegistryPrivate * const d;
+};
@@ -0,0 +1,292 @@
+#include "maptraillayer.h"
+#include "mapglobal.h"
+
+#include <QStyleOptionGraphicsItem>
+#include <QDateTime>
+#include <QPainter>
+#include <QTimer>
+#include <QHash>
+
+struct TrailRing
+{
+    QVector<QPointF> coords;
+    QVector<QPointF> points;
+    QVector<qint64> times;
+    int head = 0; // oldest point
+    int size = 0;
+
+    QPen pen;
+    bool hasPen = false;
+
+    int capacity() const { return points.size(); }
+    int at(int i) const { return (head + i) % points.size(); }
+};
+
+struct MapTrailLayer::MapTrailLayerPrivate
+{
+    MapGlobal &settings = MapGlobal::instance();
+    QRectF boundingRect;
+
+    int capacity = 256;
+    int maxAge = 0;
+    QPen pen = QPen(QColor(0, 120, 255), 2.);
+
+    QHash<int, TrailRing> trails;
+    QTimer expireTimer;
+    QVector<QLineF> lines;
+
+    void resize(TrailRing &ring) const;
+    QRectF segmentRect(const QPointF &p1, const QPointF &p2, const QPen &pen) const;
+};
+
+// keeps the newest points of the ring in the new capacity
+void MapTrailLayer::MapTrailLayerPrivate::resize(TrailRing &ring) const
+{
+    const int size = qMin(ring.size, capacity);
+    const int skip = ring.size - size;
+
+    TrailRing resized;
+    resized.coords.resize(capacity);
+    resized.points.resize(capacity);
+    resized.times.resize(capacity);
+    resized.pen = ring.pen;
+    resized.hasPen = ring.hasPen;
+
+    for (int i=0; i<size; ++i)
+    {
+        const int index = ring.at(skip + i);
+        resized.coords[i] = ring.coords.at(index);
+        resized.points[i] = ring.points.at(index);
+        resized.times[i] = ring.times.at(index);
+    }
+
+    resized.size = size;
+    ring = resized;
+}
+
+QRectF MapTrailLayer::MapTrailLayerPrivate::segmentRect(const QPointF &p1, const QPointF &p2, const QPen &pen) const
+{
+    const qreal margin = (pen.widthF() / 2. + 1.) * settings.factor();
+    return QRectF(p1, p2).normalized().adjusted(-margin, -margin, margin, margin);
+}
+
+MapTrailLayer::MapTrailLayer(QGraphicsItem *parent) : QGraphicsObject(parent),
+    d(new MapTrailLayerPrivate)
+{
+    setZValue(0.75);
+    setAcceptedMouseButtons(Qt::NoButton);
+    setFlag(ItemUsesExtendedStyleOption); // exposedRect limits the segments drawn
+
+    d->pen.setCosmetic(true);
+    d->expireTimer.setInterval(1000);
+    connect(&d->expireTimer, &QTimer::timeout, this, &MapTrailLayer::expire);
+}
+
+MapTrailLayer::~MapTrailLayer()
+{
+    delete d;
+}
+
+void MapTrailLayer::setCapacity(int points)
+{
+    d->capacity = qMax(2, points);
+
+    for (TrailRing &ring: d->trails)
+        d->resize(ring);
+
+    update();
+}
+
+int MapTrailLayer::capacity() const
+{
+    return d->capacity;
+}
+
+void MapTrailLayer::setMaxAge(int msec)
+{
+    d->maxAge = qMax(0, msec);
+
+    if (d->maxAge > 0)
+    {
+        d->expireTimer.setInterval(qBound(100, d->maxAge / 10, 1000));
+        d->expireTimer.start();
+        expire();
+    }
+    else d->expireTimer.stop();
+}
+
+int MapTrailLayer::maxAge() const
+{
+    return d->maxAge;
+}
+
+void MapTrailLayer::setPen(const QPen &pen)
+{
+    d->pen = pen;
+    d->pen.setCosmetic(true);
+    update();
+}
+
+void MapTrailLayer::setTrailPen(int trail, const QPen &pen)
+{
+    auto it = d->trails.find(trail);
+
+    if (it == d->trails.end())
+    {
+        it = d->trails.insert(trail, TrailRing());
+        d->resize(it.value());
+    }
+
+    it.value().pen = pen;
+    it.value().pen.setCosmetic(true);
+    it.value().hasPen = true;
+    update();
+}
+
+void MapTrailLayer::append(int trail, const QPointF &coords, qint64 time)
+{
+    auto it = d->trails.find(trail);
+
+    if (it == d->trails.end())
+    {
+        it = d->trails.insert(trail, TrailRing());
+        d->resize(it.value());
+    }
+
+    TrailRing &ring = it.value();
+    const QPointF point = d->settings.toPoint(coords);
+    const QPen &pen = ring.hasPen ? ring.pen : d->pen;
+
+    // the oldest point is overwritten when the ring is full
+    int index;
+
+    if (ring.size < ring.capacity())
+    {
+        index = ring.at(ring.size);
+        ++ring.size;
+    }
+    else
+    {
+        update(d->segmentRect(ring.points.at(ring.head), ring.points.at(ring.at(1)), pen));
+        index = ring.head;
+        ring.head = ring.at(1);
+    }
+
+    ring.coords[index] = coords;
+    ring.points[index] = point;
+    ring.times[index] = time < 0 ? QDateTime::currentMSecsSinceEpoch() : time;
+
+    if (ring.size > 1)
+        update(d->segmentRect(ring.points.at(ring.at(ring.size - 2)), point, pen));
+}
+
+void MapTrailLayer::removeTrail(int trail)
+{
+    if (d->trails.remove(trail))
+        update();
+}
+
+void MapTrailLayer::clear()
+{
+    d->trails.clear();
+    update();
+}
+
+bool MapTrailLayer::contains(int trail) const
+{
+    return d->trails.contains(trail);
+}
+
+int MapTrailLayer::count() const
+{
+    return d->trails.size();
+}
+
+int MapTrailLayer::pointsCount(int trail) const
+{
+    auto it = d->trails.constFind(trail);
+    return it == d->trails.cend() ? 0 : it.value().size;
+}
+
+void MapTrailLayer::updateCoords()
+{
+    for (TrailRing &ring: d->trails)
+    {
+        for (int i=0; i<ring.size; ++i)
+        {
+            const int index = ring.at(i);
+            ring.points[index] = d->settings.toPoint(ring.coords.at(index));
+        }
+    }
+
+    update();
+}
+
+void MapTrailLayer::setBoundingRect(const QRectF &rect)
+{
+    prepareGeometryChange();
+    d->boundingRect = rect;
+    update();
+}
+
+QRectF MapTrailLayer::boundingRect() const
+{
+    return d->boundingRect;
+}
+
+void MapTrailLayer::paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget)
+{
+    Q_UNUSED(widget);
+
+    const QRectF exposed = item->exposedRect.isEmpty() ? d->boundingRect : item->exposedRect;
+
+    for (const TrailRing &ring: qAsConst(d->trails))
+    {
+        if (ring.size < 2) continue;
+
+        const QPen &pen = ring.hasPen ? ring.pen : d->pen;
+        const qreal margin = (pen.widthF() / 2. + 1.) * d->settings.factor();
+        const QRectF rect = exposed.adjusted(-margin, -margin, margin, margin);
+
+        d->lines.clear();
+        QPointF previous = ring.points.at(ring.head);
+
+        for (int i=1; i<ring.size; ++i)
+        {
+            const QPointF &point = ring.points.at(ring.at(i));
+
+            if (qMin(previous.x(), point.x()) <= rect.right() && qMax(previous.x(), point.x()) >= rect.left() &&
+                qMin(previous.y(), point.y()) <= rect.bottom() && qMax(previous.y(), point.y()) >= rect.top())
+                d->lines.append(QLineF(previous, point));
+
+            previous = point;
+        }
+
+        if (d->lines.isEmpty()) continue;
+
+        painter->setPen(pen);
+        painter->drawLines(d->lines);
+    }
+}
+
+// drops the points older than maxAge from the ring heads
+void MapTrailLayer::expire()
+{
+    if (d->maxAge <= 0) return;
+
+    const qint64 limit = QDateTime::currentMSecsSinceEpoch() - d->maxAge;
+
+    for (TrailRing &ring: d->trails)
+    {
+        const QPen &pen = ring.hasPen ? ring.pen : d->pen;
+
+        while (ring.size > 0 && ring.times.at(ring.head) < limit)
+        {
+            if (ring.size > 1)
+                update(d->segmentRect(ring.points.at(ring.head), ring.points.at(ring.at(1)), pen));
+
+            ring.head = ring.at(1);
+            --ring.size;
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QGraphicsObject>
+#include <QPen>
+
+//! \brief The MapTrailLayer class, recent tracks of moving objects. Each trail
+//! keeps its projected points in a ring buffer of capacity() fixes, a new fix
+//! overwrites the oldest one and points older than maxAge() expire. Only the
+//! area of added and expired segments is repainted.
+class MapTrailLayer : public QGraphicsObject
+{
+    Q_OBJECT
+public:
+    explicit MapTrailLayer(QGraphicsItem *parent = Q_NULLPTR);
+    ~MapTrailLayer();
+
+    void setCapacity(int points); // per trail, the newest points are kept
+    int capacity() const;
+
+    void setMaxAge(int msec); // 0 keeps points until the ring is full
+    int maxAge() const;
+
+    void setPen(const QPen &pen); // cosmetic, for trails without their own pen
+    void setTrailPen(int trail, const QPen &pen);
+
+    // time in msecs since epoch, -1 for now
+    void append(int trail, const QPointF &coords, qint64 time = -1); // QPointF(longitude, latitude)
+    void removeTrail(int trail);
+    void clear();
+
+    bool contains(int trail) const;
+    int count() const;
+    int pointsCount(int trail) const;
+
+    void updateCoords();
+    void setBoundingRect(const QRectF &rect);
+
+private:
+    QRectF boundingRect() const;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget);
+    void expire();
+
+    struct MapTrailLayerPrivate;
+    MapTrailLayerPrivate * const d;
+};
@@ -0,0 +1,192 @@
+#include "mapurltemplate.h"
+
+#include <QVector>
+#include <QPair>
+
+struct MapUrlTemplateData : public QSharedData
+{
+    enum SegmentType
+    {
+        Text = 0,
+        X,
+        Y,
+        Z,
+        Quadkey,
+        Subdomain,
+        Retina
+    };
+
+    struct Segment
+    {
+        SegmentType type;
+        int begin;
+        int length;
+    };
+
+    QString pattern;
+    QStringList subdomains;
+    QString retina;
+    QVector<Segment> segments;
+};
+
+static void appendNumber(QString &url, int value)
+{
+    QChar digits[12];
+    int pos = 12;
+    unsigned int number = value < 0 ? 0u - static_cast<unsigned int>(value) : static_cast<unsigned int>(value);
+
+    do
+    {
+        digits[--pos] = QLatin1Char(static_cast<char>('0' + number % 10));
+        number /= 10;
+    }
+    while (number);
+
+    if (value < 0)
+        digits[--pos] = QLatin1Char('-');
+
+    url.append(digits + pos, 12 - pos);
+}
+
+static void appendQuadkey(QString &url, int x, int y, int z)
+{
+    QChar key[32];
+    int length = 0;
+
+    for (int i = qMin(z, 32); i > 0; i--)
+    {
+        char digit = '0';
+        int mask = 1 << (i - 1);
+        if ((x & mask) != 0) digit++;
+        if ((y & mask) != 0) digit += 2;
+
+        key[length++] = QLatin1Char(digit);
+    }
+
+    url.append(key, length);
+}
+
+MapUrlTemplate::MapUrlTemplate() :
+    d(new MapUrlTemplateData)
+{
+}
+
+MapUrlTemplate::MapUrlTemplate(const QString &pattern, const QStringList &subdomains, const QString &retina) :
+    d(new MapUrlTemplateData)
+{
+    d->subdomains = subdomains;
+    d->retina = retina;
+    setPattern(pattern);
+}
+
+MapUrlTemplate::MapUrlTemplate(const MapUrlTemplate &other) :
+    d(other.d)
+{
+}
+
+MapUrlTemplate &MapUrlTemplate::operator=(const MapUrlTemplate &other)
+{
+    d = other.d;
+    return *this;
+}
+
+MapUrlTemplate::~MapUrlTemplate()
+{
+}
+
+void MapUrlTemplate::setPattern(const QString &pattern)
+{
+    static const QVector<QPair<QString, MapUrlTemplateData::SegmentType>> placeholders = {
+        {"{x}", MapUrlTemplateData::X}, {"{y}", MapUrlTemplateData::Y}, {"{z}", MapUrlTemplateData::Z},
+        {"{quadkey}", MapUrlTemplateData::Quadkey}, {"{s}", MapUrlTemplateData::Subdomain},
+        {"{r}", MapUrlTemplateData::Retina} };
+
+    d->pattern = pattern;
+    d->segments.clear();
+
+    int textBegin = 0;
+    int pos = 0;
+
+    while ((pos = d->pattern.indexOf('{', pos)) >= 0)
+    {
+        bool found = false;
+
+        for (const QPair<QString, MapUrlTemplateData::SegmentType> &placeholder: placeholders)
+        {
+            if (d->pattern.mid(pos, placeholder.first.size()) != placeholder.first) continue;
+
+            if (pos > textBegin)
+                d->segments.append({MapUrlTemplateData::Text, textBegin, pos - textBegin});
+
+            d->segments.append({placeholder.second, pos, placeholder.first.size()});
+            pos += placeholder.first.size();
+            textBegin = pos;
+            found = true;
+            break;
+        }
+
+        if (!found) ++pos;
+    }
+
+    if (textBegin < d->pattern.size())
+        d->segments.append({MapUrlTemplateData::Text, textBegin, d->pattern.size() - textBegin});
+}
+
+QString MapUrlTemplate::pattern() const
+{
+    return d->pattern;
+}
+
+void MapUrlTemplate::setSubdomains(const QStringList &subdomains)
+{
+    d->subdomains = subdomains;
+}
+
+void MapUrlTemplate::setRetina(const QString &retina)
+{
+    d->retina = retina;
+}
+
+bool MapUrlTemplate::hasPlaceholders() const
+{
+    for (const MapUrlTemplateData::Segment &segment: d->segments)
+        if (segment.type != MapUrlTemplateData::Text) return true;
+
+    return false;
+}
+
+void MapUrlTemplate::format(int x, int y, int z, QString &url) const
+{
+    // resize keeps the allocated capacity of the buffer
+    url.resize(0);
+    url.reserve(d->pattern.size() + 32);
+
+    for (const MapUrlTemplateData::Segment &segment: d->segments)
+    {
+        switch (segment.type)
+        {
+        case MapUrlTemplateData::Text:
+            url.append(d->pattern.constData() + segment.begin, segment.length);
+            break;
+        case MapUrlTemplateData::X:
+            appendNumber(url, x);
+            break;
+        case MapUrlTemplateData::Y:
+            appendNumber(url, y);
+            break;
+        case MapUrlTemplateData::Z:
+            appendNumber(url, z);
+            break;
+        case MapUrlTemplateData::Quadkey:
+            appendQuadkey(url, x, y, z);
+            break;
+        case MapUrlTemplateData::Subdomain:
+            if (!d->subdomains.isEmpty())
+                url.append(d->subdomains.at(qAbs(x + y) % d->subdomains.size()));
+            break;
+        case MapUrlTemplateData::Retina:
+            url.append(d->retina);
+            break;
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QSharedDataPointer>
+#include <QStringList>
+#include <QString>
+
+struct MapUrlTemplateData;
+
+//! \brief The MapUrlTemplate class, tile url pattern parsed once and formatted
+//! into a reused buffer. Placeholders: {x}, {y}, {z}, {quadkey} (Bing tiles),
+//! {s} (one of subdomains, stable per tile) and {r} (retina suffix).
+class MapUrlTemplate
+{
+public:
+    MapUrlTemplate();
+    explicit MapUrlTemplate(const QString &pattern,
+                            const QStringList &subdomains = QStringList(),
+                            const QString &retina = QString());
+    MapUrlTemplate(const MapUrlTemplate &other);
+    MapUrlTemplate &operator=(const MapUrlTemplate &other);
+    ~MapUrlTemplate();
+
+    void setPattern(const QString &pattern);
+    QString pattern() const;
+
+    void setSubdomains(const QStringList &subdomains);
+    void setRetina(const QString &retina);
+
+    bool hasPlaceholders() const;
+
+    void format(int x, int y, int z, QString &url) const;
+
+private:
+    QSharedDataPointer<MapUrlTemplateData> d;
+};
@@ -1,13 +1,28 @@
 #include "mapview.h"
 #include "maploader.h"
+#include "mapspatialindex.h"
 
+#include <QtConcurrentMap>
 #include <QGraphicsScene>
+#include <QFutureWatcher>
+#include <QElapsedTimer>
 #include <QMouseEvent>
 #include <QWheelEvent>
+#include <QPointer>
 #include <QPainter>
 #include <QDebug>
 #include <QTimer>
 #include <QtMath>
+#include <QHash>
+#include <algorithm>
+
+// static items with more points in total are projected off the GUI thread
+static const int BACKGROUND_PROJECTION_POINTS = 50000;
+
+// frame stats overlay in the top left corner of the viewport
+static const int STATS_OVERLAY_MARGIN = 8;
+static const int STATS_OVERLAY_WIDTH = 300;
+static const int STATS_OVERLAY_HEIGHT = 76;
 
 inline bool operator <(const QPoint &p1, const QPoint &p2)
 {
@@ -15,18 +30,59 @@ inline bool operator <(const QPoint &p1, const QPoint &p2)
            (static_cast<qint64>(p2.x()) | (static_cast<qint64>(p2.y()) << 32));
 }
 
+struct ProjectionTask
+{
+    QPointer<MapItem> item;
+    quint64 version;
+    MapItemType type;
+    QVector<QPointF> coords;
+    bool closed;
+    MapItemGeometry geometry;
+};
+
 struct MapView::MapViewPrivate
 {
     MapGlobal &settings = MapGlobal::instance();
     MapLoader *tileLoader = Q_NULLPTR;
     MapObject *map = Q_NULLPTR;
+    MapClusterLayer *clusterLayer = Q_NULLPTR;
+    MapLabelLayer *labelLayer = Q_NULLPTR;
+    MapOverlay *overlay = Q_NULLPTR;
 
     bool        isMove = false;
+    bool        isItemUnderMouse = false;
+    bool        isClustering = false;
+    bool        isLabeling = false;
+    bool        isRasterizing = false;
     quint64     tileWidthScaled;
     QRect       indentRect;
     qreal       scale = settings.tilesCount();
 
-    QVector<MapItem*> items;
+    QHash<MapItem*, quint64> items; // insertion serials, the scene removes items in this order fastest
+    quint64 itemsSerial = 0;
+    QVector<MapMarkerLayer*> markerLayers;
+    QVector<MapHeatmapLayer*> heatmapLayers;
+    QVector<MapTrailLayer*> trailLayers;
+    MapSpatialIndex index;
+
+    QFutureWatcher<void> projectionWatcher;
+    QVector<ProjectionTask> projectionTasks;
+    QVector<QPointer<MapItem>> pendingItems;
+
+    // live positions of the next frame, a slot per item
+    QTimer liveTimer;
+    QHash<MapItem*, int> liveSlots;
+    QVector<MapItem*> liveItems;
+    QVector<QPointF> liveCoords;
+    QVector<qreal> liveHeadings;
+    MapUpdateStats updateStats;
+
+    bool isFrameStats = false;
+    bool isStatsOverlay = false;
+    MapFrameStats frameStats;
+    qreal paintMsecSum = 0.;
+    QTimer statsTimer;
+    bool isOverlayRepaint = false; // set by statsTimer, the repaint is not a frame
 };
 
 MapView::MapView(QWidget *parent) : QGraphicsView(parent),
@@ -45,7 +101,10 @@ MapView::MapView(QWidget *parent) : QGraphicsView(parent),
     setCacheMode(QGraphicsView::CacheBackground);
     viewport()->setCursor(cursor());
 
+    // MapSpatialIndex culls items and finds them under the mouse, the scene
+    // BSP tree only slows down moving items
     QGraphicsScene *scene = new QGraphicsScene(this);
+    scene->setItemIndexMethod(QGraphicsScene::NoIndex);
     setScene(scene);
     setSceneRect(0., 0.,
                  d->scale * static_cast<qreal>(d->settings.tileWidth()),
@@ -54,17 +113,53 @@ MapView::MapView(QWidget *parent) : QGraphicsView(parent),
     d->map = new MapObject;
     scene->addItem(d->map);
 
+    d->clusterLayer = new MapClusterLayer;
+    d->clusterLayer->hide();
+    scene->addItem(d->clusterLayer);
+
+    d->labelLayer = new MapLabelLayer;
+    d->labelLayer->hide();
+    scene->addItem(d->labelLayer);
+
     connect(d->map, &MapObject::tileRequest, d->tileLoader, &MapLoader::loadTile);
     connect(d->tileLoader, &MapLoader::loaded, d->map, &MapObject::setTile);
 
+    d->overlay = new MapOverlay(&d->index, this);
+    connect(d->map, &MapObject::overlayRequest, d->overlay, &MapOverlay::requestTile);
+    connect(d->overlay, &MapOverlay::tileReady, d->map, &MapObject::setOverlayTile);
+    connect(d->overlay, &MapOverlay::invalidated, d->map, &MapObject::updateOverlay);
+    connect(&d->projectionWatcher, &QFutureWatcher<void>::finished, this, &MapView::onProjectionFinished);
+
+    d->liveTimer.setSingleShot(true);
+    d->liveTimer.setInterval(16);
+    connect(&d->liveTimer, &QTimer::timeout, this, &MapView::applyPositions);
+
+    // the overlay is repainted on its own, frames may not cover it
+    d->statsTimer.setInterval(500);
+    connect(&d->statsTimer, &QTimer::timeout, this, [this]()
+    {
+        d->isOverlayRepaint = true;
+        viewport()->update(STATS_OVERLAY_MARGIN, STATS_OVERLAY_MARGIN, STATS_OVERLAY_WIDTH, STATS_OVERLAY_HEIGHT);
+    });
+
     calculateMapGeometry();
 }
 
 MapView::~MapView()
 {
+    d->projectionWatcher.cancel();
+    d->projectionWatcher.waitForFinished();
+
     clearMap();
+    qDeleteAll(d->markerLayers);
+    qDeleteAll(d->heatmapLayers);
+    qDeleteAll(d->trailLayers);
+
+    delete d->overlay;
 
     delete d->tileLoader;
+    delete d->clusterLayer;
+    delete d->labelLayer;
     delete d->map;
     delete d;
 }
@@ -75,11 +170,24 @@ void MapView::setProvider(const QString &provider)
 
     QPointF sceneCenter = mapToScene(viewport()->rect().center());
     QPointF center = d->settings.toCoords(sceneCenter);
+    const CoordsTypes coordsType = d->settings.coordsType();
     d->settings.setCurrentProvider(provider);
     setCenterOn(center);
 
-    for (MapItem *item: qAsConst(d->items))
-        item->updateCoords();
+    // items keep their scene geometry between providers of one projection
+    if (d->settings.coordsType() != coordsType)
+    {
+        updateItemsCoords();
+
+        for (MapMarkerLayer *layer: qAsConst(d->markerLayers))
+            layer->updateCoords();
+
+        for (MapHeatmapLayer *layer: qAsConst(d->heatmapLayers))
+            layer->updateCoords();
+
+        for (MapTrailLayer *layer: qAsConst(d->trailLayers))
+            layer->updateCoords();
+    }
 
     d->map->updateTiles();
 }
@@ -116,6 +224,12 @@ void MapView::setZoom(int value)
                  1 / d->settings.factor());
 
     setTransform(matrix);
+    d->clusterLayer->setFactor(d->settings.factor());
+    d->labelLayer->setFactor(d->settings.factor());
+
+    for (auto it = d->items.cbegin(); it != d->items.cend(); ++it)
+        it.key()->updateFactor();
+
     calculateMapGeometry();
 
     emit zoomChanged(d->settings.zoom());
@@ -142,26 +256,374 @@ QPointF MapView::center()
 MapItem *MapView::createItem()
 {
     MapItem *item = new MapItem;
-    d->items.append(item);
+    d->items.insert(item, d->itemsSerial++);
     scene()->addItem(item);
+    d->index.insert(item);
+
+    if (d->isClustering)
+        d->clusterLayer->insertItem(item);
+
+    if (d->isLabeling)
+        d->labelLayer->insertItem(item);
+
+    if (d->isRasterizing)
+        d->overlay->insertItem(item);
 
     return item;
 }
 
 void MapView::removeItem(MapItem *item)
 {
-    if (!d->items.contains(item)) return;
+    if (!d->items.remove(item)) return;
 
-    d->items.removeOne(item);
+    dropPositions(item);
+    d->index.remove(item);
+    d->clusterLayer->removeItem(item);
+    d->labelLayer->removeItem(item);
+    d->overlay->removeItem(item);
     item->deleteLater();
 }
 
 void MapView::clearMap()
 {
-    foreach (MapItem *item, d->items)
-        item->deleteLater();
+    d->index.clear();
+    d->clusterLayer->clear();
+    d->labelLayer->clear();
+    d->overlay->clear();
+
+    for (MapItem *item: qAsConst(d->liveItems))
+        if (item) ++d->updateStats.dropped;
+
+    d->liveSlots.clear();
+    d->liveItems.clear();
+    d->liveCoords.clear();
+    d->liveHeadings.clear();
+
+    QVector<QPair<quint64, MapItem*>> items;
+    items.reserve(d->items.size());
+
+    for (auto it = d->items.cbegin(); it != d->items.cend(); ++it)
+        items.append(qMakePair(it.value(), it.key()));
 
     d->items.clear();
+    deleteItems(items);
+}
+
+QVector<MapItem*> MapView::createItems(int count, const std::function<void(MapItem*, int)> &init)
+{
+    QVector<MapItem*> items;
+    items.reserve(count);
+    d->items.reserve(d->items.size() + count);
+
+    for (int i=0; i<count; ++i)
+    {
+        MapItem *item = new MapItem;
+        if (init) init(item, i);
+
+        items.append(item);
+        d->items.insert(item, d->itemsSerial++);
+    }
+
+    // culled items are hidden before the scene sees them
+    d->index.insert(items);
+
+    for (MapItem *item: qAsConst(items))
+        scene()->addItem(item);
+
+    if (d->isClustering)
+    {
+        for (MapItem *item: qAsConst(items))
+            d->clusterLayer->insertItem(item);
+    }
+
+    if (d->isLabeling)
+    {
+        for (MapItem *item: qAsConst(items))
+            d->labelLayer->insertItem(item);
+    }
+
+    if (d->isRasterizing)
+    {
+        for (MapItem *item: qAsConst(items))
+            d->overlay->insertItem(item);
+    }
+
+    return items;
+}
+
+void MapView::removeItems(const QVector<MapItem*> &items)
+{
+    QVector<QPair<quint64, MapItem*>> removed;
+    removed.reserve(items.size());
+
+    for (MapItem *item: items)
+    {
+        auto it = d->items.find(item);
+        if (it == d->items.end()) continue;
+
+        removed.append(qMakePair(it.value(), item));
+        d->items.erase(it);
+
+        dropPositions(item);
+        d->index.remove(item);
+        d->clusterLayer->removeItem(item);
+        d->labelLayer->removeItem(item);
+        d->overlay->removeItem(item);
+    }
+
+    deleteItems(removed);
+}
+
+void MapView::updatePositions(const QVector<MapItem*> &items, const QVector<QPointF> &coords,
+                              const QVector<qreal> &headings)
+{
+    const int count = qMin(items.size(), coords.size());
+    d->updateStats.received += static_cast<quint64>(count);
+
+    for (int i=0; i<count; ++i)
+    {
+        MapItem *item = items.at(i);
+        const qreal heading = i < headings.size() ? headings.at(i) : qQNaN();
+
+        if (!d->items.contains(item))
+        {
+            ++d->updateStats.dropped;
+            continue;
+        }
+
+        auto it = d->liveSlots.constFind(item);
+        if (it != d->liveSlots.cend())
+        {
+            ++d->updateStats.merged;
+            d->liveCoords[it.value()] = coords.at(i);
+            if (!qIsNaN(heading)) d->liveHeadings[it.value()] = heading;
+            continue;
+        }
+
+        d->liveSlots.insert(item, d->liveItems.size());
+        d->liveItems.append(item);
+        d->liveCoords.append(coords.at(i));
+        d->liveHeadings.append(heading);
+    }
+
+    if (!d->liveItems.isEmpty() && !d->liveTimer.isActive())
+        d->liveTimer.start();
+}
+
+void MapView::setUpdateInterval(int msec)
+{
+    d->liveTimer.setInterval(qMax(0, msec));
+}
+
+int MapView::updateInterval() const
+{
+    return d->liveTimer.interval();
+}
+
+MapUpdateStats MapView::updateStats() const
+{
+    return d->updateStats;
+}
+
+void MapView::resetUpdateStats()
+{
+    d->updateStats = MapUpdateStats();
+}
+
+MapLoaderStats MapView::loaderStats() const
+{
+    return d->tileLoader->stats();
+}
+
+void MapView::resetLoaderStats()
+{
+    d->tileLoader->resetStats();
+}
+
+void MapView::setFrameStats(bool state)
+{
+    d->isFrameStats = state;
+    d->map->setTiming(state);
+
+    if (!state) setStatsOverlay(false);
+}
+
+bool MapView::isFrameStats() const
+{
+    return d->isFrameStats;
+}
+
+MapFrameStats MapView::frameStats() const
+{
+    return d->frameStats;
+}
+
+void MapView::resetFrameStats()
+{
+    d->frameStats = MapFrameStats();
+    d->paintMsecSum = 0.;
+}
+
+void MapView::setStatsOverlay(bool state)
+{
+    if (d->isStatsOverlay == state) return;
+
+    d->isStatsOverlay = state;
+
+    if (state)
+    {
+        setFrameStats(true);
+        d->statsTimer.start();
+    }
+    else d->statsTimer.stop();
+
+    viewport()->update();
+}
+
+bool MapView::isStatsOverlay() const
+{
+    return d->isStatsOverlay;
+}
+
+QVector<MapItem*> MapView::findItems(const QPointF &boundLeftTop, const QPointF &boundRightBottom)
+{
+    const QRectF rect = QRectF(d->settings.toPoint(boundLeftTop),
+                               d->settings.toPoint(boundRightBottom)).normalized();
+    return d->index.items(rect, d->settings.factor());
+}
+
+MapItem *MapView::findItemAt(const QPointF &coords)
+{
+    return d->index.itemAt(d->settings.toPoint(coords), d->settings.factor());
+}
+
+MapMarkerLayer *MapView::createMarkerLayer()
+{
+    MapMarkerLayer *layer = new MapMarkerLayer;
+    layer->setBoundingRect(QRectF(mapToScene(0, 0), mapToScene(width(), height())));
+    d->markerLayers.append(layer);
+    scene()->addItem(layer);
+
+    return layer;
+}
+
+void MapView::removeMarkerLayer(MapMarkerLayer *layer)
+{
+    if (!d->markerLayers.removeOne(layer)) return;
+
+    delete layer;
+}
+
+MapHeatmapLayer *MapView::createHeatmapLayer()
+{
+    MapHeatmapLayer *layer = new MapHeatmapLayer;
+    layer->setBoundingRect(QRectF(mapToScene(0, 0), mapToScene(width(), height())));
+    d->heatmapLayers.append(layer);
+    scene()->addItem(layer);
+
+    return layer;
+}
+
+void MapView::removeHeatmapLayer(MapHeatmapLayer *layer)
+{
+    if (!d->heatmapLayers.removeOne(layer)) return;
+
+    delete layer;
+}
+
+MapTrailLayer *MapView::createTrailLayer()
+{
+    MapTrailLayer *layer = new MapTrailLayer;
+    layer->setBoundingRect(QRectF(mapToScene(0, 0), mapToScene(width(), height())));
+    d->trailLayers.append(layer);
+    scene()->addItem(layer);
+
+    return layer;
+}
+
+void MapView::removeTrailLayer(MapTrailLayer *layer)
+{
+    if (!d->trailLayers.removeOne(layer)) return;
+
+    delete layer;
+}
+
+void MapView::setClustering(bool state)
+{
+    if (d->isClustering == state) return;
+
+    d->isClustering = state;
+    d->clusterLayer->setVisible(state);
+
+    if (state)
+    {
+        d->clusterLayer->setFactor(d->settings.factor());
+
+        for (auto it = d->items.cbegin(); it != d->items.cend(); ++it)
+            d->clusterLayer->insertItem(it.key());
+    }
+    else d->clusterLayer->clear();
+}
+
+bool MapView::isClustering() const
+{
+    return d->isClustering;
+}
+
+MapClusterLayer *MapView::clusterLayer() const
+{
+    return d->clusterLayer;
+}
+
+void MapView::setLabeling(bool state)
+{
+    if (d->isLabeling == state) return;
+
+    d->isLabeling = state;
+    d->labelLayer->setVisible(state);
+
+    if (state)
+    {
+        d->labelLayer->setFactor(d->settings.factor());
+
+        for (auto it = d->items.cbegin(); it != d->items.cend(); ++it)
+            d->labelLayer->insertItem(it.key());
+    }
+    else d->labelLayer->clear();
+}
+
+bool MapView::isLabeling() const
+{
+    return d->isLabeling;
+}
+
+MapLabelLayer *MapView::labelLayer() const
+{
+    return d->labelLayer;
+}
+
+void MapView::setRasterizing(bool state)
+{
+    if (d->isRasterizing == state) return;
+
+    d->isRasterizing = state;
+
+    if (state)
+    {
+        for (auto it = d->items.cbegin(); it != d->items.cend(); ++it)
+            d->overlay->insertItem(it.key());
+    }
+    else d->overlay->clear();
+}
+
+bool MapView::isRasterizing() const
+{
+    return d->isRasterizing;
+}
+
+MapOverlay *MapView::overlay() const
+{
+    return d->overlay;
 }
 
 void MapView::showEvent(QShowEvent *e)
@@ -202,15 +664,92 @@ void MapView::drawBackground(QPainter *painter, const QRectF &r)
     painter->drawRect(sceneRect());
 }
 
+// shows the stats of the previous frame
+void MapView::drawForeground(QPainter *painter, const QRectF &r)
+{
+    QGraphicsView::drawForeground(painter, r);
+    if (!d->isStatsOverlay) return;
+
+    const MapFrameStats &stats = d->frameStats;
+    const QString text = QString("frame %1 ms, avg %2, max %3\n"
+                                 "map %4 ms, items %5 ms\n"
+                                 "tiles %6 drawn, %7 loading, %8 pending\n"
+                                 "items %9 visible")
+            .arg(stats.paintMsec, 0, 'f', 1).arg(stats.averagePaintMsec, 0, 'f', 1)
+            .arg(stats.maxPaintMsec, 0, 'f', 1).arg(stats.mapMsec, 0, 'f', 1)
+            .arg(stats.itemsMsec, 0, 'f', 1).arg(stats.tilesDrawn).arg(stats.placeholders)
+            .arg(stats.pendingTiles).arg(stats.visibleItems);
+
+    const QRect rect(STATS_OVERLAY_MARGIN, STATS_OVERLAY_MARGIN, STATS_OVERLAY_WIDTH, STATS_OVERLAY_HEIGHT);
+
+    painter->save();
+    painter->resetTransform();
+    painter->setPen(Qt::NoPen);
+    painter->setBrush(QColor(0, 0, 0, 160));
+    painter->drawRect(rect);
+    painter->setPen(Qt::white);
+    painter->drawText(rect.adjusted(6, 4, -6, -4), Qt::AlignLeft | Qt::AlignTop, text);
+    painter->restore();
+}
+
+void MapView::paintEvent(QPaintEvent *e)
+{
+    if (!d->isFrameStats)
+    {
+        QGraphicsView::paintEvent(e);
+        return;
+    }
+
+    // a repaint of the overlay alone would count as a fast frame
+    const QRect overlayRect(STATS_OVERLAY_MARGIN, STATS_OVERLAY_MARGIN, STATS_OVERLAY_WIDTH, STATS_OVERLAY_HEIGHT);
+    const bool isOverlayRepaint = d->isOverlayRepaint && overlayRect.contains(e->rect());
+    d->isOverlayRepaint = false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QGraphicsView::paintEvent(e);
+
+    if (isOverlayRepaint)
+    {
+        d->map->takePaintTime();
+        return;
+    }
+
+    const qreal paintMsec = timer.nsecsElapsed() / 1e6;
+    const qreal mapMsec = d->map->takePaintTime() / 1e6;
+
+    MapFrameStats &stats = d->frameStats;
+    ++stats.frames;
+    stats.paintMsec = paintMsec;
+    stats.mapMsec = mapMsec;
+    stats.itemsMsec = qMax(0., paintMsec - mapMsec);
+    stats.maxPaintMsec = qMax(stats.maxPaintMsec, paintMsec);
+
+    d->paintMsecSum += paintMsec;
+    stats.averagePaintMsec = d->paintMsecSum / stats.frames;
+
+    d->map->tilesCount(stats.tilesDrawn, stats.placeholders);
+    stats.visibleItems = d->index.visibleCount();
+    stats.pendingTiles = d->tileLoader->stats().pending;
+}
+
 void MapView::mousePressEvent(QMouseEvent *e)
 {
+    const bool isInteractive = this->isInteractive();
+    setInteractive(isInteractive && isSceneEvent(e));
     QGraphicsView::mousePressEvent(e);
+    setInteractive(isInteractive);
+
     emit pressCoords(d->settings.toCoords(mapToScene(e->pos())), true, e->button());
 }
 
 void MapView::mouseMoveEvent(QMouseEvent *e)
 {
+    const bool isInteractive = this->isInteractive();
+    setInteractive(isInteractive && isSceneEvent(e));
     QGraphicsView::mouseMoveEvent(e);
+    setInteractive(isInteractive);
 
     if (e->buttons() == Qt::LeftButton)
     {
@@ -225,9 +764,18 @@ void MapView::mouseMoveEvent(QMouseEvent *e)
 
 void MapView::mouseReleaseEvent(QMouseEvent *e)
 {
+    const bool isInteractive = this->isInteractive();
+    const bool isRouted = isInteractive && isSceneEvent(e);
+
+    setInteractive(isRouted);
     QGraphicsView::mouseReleaseEvent(e);
+    setInteractive(isInteractive);
     viewport()->setCursor(cursor());
 
+    // the view clears the selection on a click only if the scene got the event
+    if (isInteractive && !isRouted && !d->isMove && e->button() == Qt::LeftButton)
+        scene()->clearSelection();
+
     if (!d->isMove)
         emit clickCoords(d->settings.toCoords(mapToScene(e->pos())), e->button());
 
@@ -236,11 +784,39 @@ void MapView::mouseReleaseEvent(QMouseEvent *e)
     d->isMove = false;
 }
 
+// without an index the scene scans all items to find the ones under the
+// mouse, so it gets only the events MapSpatialIndex finds an item for, the
+// events of the mouse grabber and the first one after leaving an item for
+// its hover leave; hand dragging works without the scene
+bool MapView::isSceneEvent(QMouseEvent *e)
+{
+    if (scene()->mouseGrabberItem()) return true;
+
+    const bool isItem = d->index.itemAt(mapToScene(e->pos()), d->settings.factor()) != Q_NULLPTR;
+    const bool result = isItem || d->isItemUnderMouse;
+    d->isItemUnderMouse = isItem;
+
+    return result;
+}
+
 void MapView::calculateMapGeometry()
 {
     QRectF visibleRect = QRectF(mapToScene(0, 0), mapToScene(width(), height()));
     qreal tileWidth = static_cast<qreal>(d->settings.tileWidth()) * d->settings.factor();
     d->map->setBoundingRect(visibleRect);
+    d->clusterLayer->setBoundingRect(visibleRect);
+    d->labelLayer->setBoundingRect(visibleRect);
+
+    for (MapMarkerLayer *layer: qAsConst(d->markerLayers))
+        layer->setBoundingRect(visibleRect);
+
+    for (MapHeatmapLayer *layer: qAsConst(d->heatmapLayers))
+        layer->setBoundingRect(visibleRect);
+
+    for (MapTrailLayer *layer: qAsConst(d->trailLayers))
+        layer->setBoundingRect(visibleRect);
+
+    d->index.setViewport(visibleRect, d->settings.factor());
 
     QRect mapRect;
 
@@ -272,6 +848,155 @@ void MapView::calculateMapGeometry()
     }
 }
 
+// one deferred call instead of a deleteLater() event per item
+// items leave the scene in insertion order, each removal then finds the item
+// at the front of the top level items instead of searching all of them.
+// They are deleted later, the caller may be a slot of one of them.
+void MapView::deleteItems(QVector<QPair<quint64, MapItem*>> items)
+{
+    if (items.isEmpty()) return;
+
+    std::sort(items.begin(), items.end());
+
+    QVector<MapItem*> removed;
+    removed.reserve(items.size());
+
+    for (const QPair<quint64, MapItem*> &item: qAsConst(items))
+    {
+        scene()->removeItem(item.second);
+        removed.append(item.second);
+    }
+
+    QTimer::singleShot(0, this, [removed]() {
+        qDeleteAll(removed);
+    });
+}
+
+void MapView::updateItemsCoords()
+{
+    d->projectionWatcher.cancel();
+    d->projectionWatcher.waitForFinished();
+    d->projectionTasks.clear();
+
+    for (const QPointer<MapItem> &item: qAsConst(d->pendingItems))
+        if (item) item->setHiddenFlag(MapItem::Pending, false);
+
+    d->pendingItems.clear();
+
+    const CoordsTypes coordsType = d->settings.coordsType();
+    QVector<ProjectionTask> tasks;
+    int pointsCount = 0;
+
+    for (auto it = d->items.cbegin(); it != d->items.cend(); ++it)
+    {
+        MapItem *item = it.key();
+
+        if (!item->isStatic() || item->hasGeometry(coordsType))
+        {
+            item->updateCoords();
+            continue;
+        }
+
+        tasks.append({item, item->geometryVersion(), item->itemType(), item->coordsList(), item->isClosed(), MapItemGeometry()});
+        pointsCount += tasks.last().coords.size();
+    }
+
+    if (pointsCount < BACKGROUND_PROJECTION_POINTS)
+    {
+        for (const ProjectionTask &task: qAsConst(tasks))
+            task.item->updateCoords();
+
+        return;
+    }
+
+    // items are hidden until their geometry in the new projection is ready
+    for (const ProjectionTask &task: qAsConst(tasks))
+    {
+        task.item->setHiddenFlag(MapItem::Pending, true);
+        d->pendingItems.append(task.item);
+    }
+
+    d->projectionTasks = tasks;
+    d->projectionWatcher.setFuture(QtConcurrent::map(d->projectionTasks, [coordsType](ProjectionTask &task) {
+        task.geometry = MapItem::projectGeometry(task.type, task.coords, task.closed, coordsType);
+
+        if (task.type == MapItemType::StaticPath)
+            task.geometry.levels = MapItem::buildLevels(task.geometry.path, task.closed);
+    }));
+}
+
+void MapView::dropPositions(MapItem *item)
+{
+    auto it = d->liveSlots.find(item);
+    if (it == d->liveSlots.end()) return;
+
+    d->liveItems[it.value()] = Q_NULLPTR;
+    d->liveSlots.erase(it);
+    ++d->updateStats.dropped;
+}
+
+// one bulk projection and one pass over the items, the scene repaints once
+void MapView::applyPositions()
+{
+    const int count = d->liveItems.size();
+    QVector<QPointF> points(count);
+    d->settings.toPoints(d->liveCoords.constData(), points.data(), count);
+
+    QVector<MapItem*> moved;
+    moved.reserve(count);
+
+    for (int i=0; i<count; ++i)
+    {
+        MapItem *item = d->liveItems.at(i);
+        if (!item) continue;
+
+        item->setPosition(d->liveCoords.at(i), points.at(i), true);
+        moved.append(item);
+
+        if (!qIsNaN(d->liveHeadings.at(i)))
+            item->rotate(d->liveHeadings.at(i));
+
+        ++d->updateStats.applied;
+    }
+
+    // the index and the layers are updated once for the frame
+    d->index.update(moved);
+
+    if (d->isClustering)
+        d->clusterLayer->updateItems(moved);
+
+    if (d->isLabeling)
+        d->labelLayer->updateItems(moved);
+
+    if (d->isRasterizing)
+    {
+        for (MapItem *item: qAsConst(moved))
+            if (item->isStatic()) d->overlay->updateItem(item);
+    }
+
+    ++d->updateStats.frames;
+
+    d->liveSlots.clear();
+    d->liveItems.clear();
+    d->liveCoords.clear();
+    d->liveHeadings.clear();
+}
+
+void MapView::onProjectionFinished()
+{
+    if (d->projectionWatcher.isCanceled()) return;
+
+    for (const ProjectionTask &task: qAsConst(d->projectionTasks))
+        if (task.item) task.item->insertGeometry(task.geometry, task.version);
+
+    d->projectionTasks.clear();
+
+    for (const QPointer<MapItem> &item: qAsConst(d->pendingItems))
+        if (item) item->setHiddenFlag(MapItem::Pending, false);
+
+    d->pendingItems.clear();
+}
+
 /*********************** MapObject ***********************/
 struct MapObject::MapObjectPrivate
 {
@@ -279,12 +1004,20 @@ struct MapObject::MapObjectPrivate
     QRectF boundingRect;
     qreal tileWidth;
     QMap<QPoint, QPixmap> tiles;
+    QMap<QPoint, QPixmap> overlayTiles;
+    QPixmap placeholder; // shared by the tiles not loaded yet
+
+    bool isTiming = false;
+    qint64 paintTime = 0;
 };
 
 MapObject::MapObject(QGraphicsItem *parent) : QGraphicsObject(parent),
     d(new MapObjectPrivate)
 {
     setCacheMode(DeviceCoordinateCache);
+
+    d->placeholder = QPixmap(256, 256);
+    d->placeholder.fill();
 }
 
 MapObject::~MapObject()
@@ -300,10 +1033,21 @@ void MapObject::setTile(const QPoint &pos, const QPixmap &pix)
     update();
 }
 
+void MapObject::setOverlayTile(const QPoint &pos, const QPixmap &pix)
+{
+    if (!d->tiles.contains(pos)) return;
+
+    if (pix.isNull()) d->overlayTiles.remove(pos);
+    else d->overlayTiles[pos] = pix;
+
+    update();
+}
+
 void MapObject::setTileWidth(qreal tileWidth)
 {
     d->tileWidth = static_cast<qreal>(tileWidth);
     d->tiles.clear();
+    d->overlayTiles.clear();
 }
 
 void MapObject::setGeometry(const QRect &rect)
@@ -322,6 +1066,7 @@ void MapObject::setBoundingRect(const QRectF &rect)
 void MapObject::updateTiles()
 {
     d->tiles.clear();
+    d->overlayTiles.clear();
 
     for (int i=d->tilesRect.x(); i<d->tilesRect.width() + d->tilesRect.x(); ++i)
     {
@@ -330,11 +1075,9 @@ void MapObject::updateTiles()
             QPoint pos(i, j);
             if (!d->tiles.contains(pos))
             {
-                QPixmap pix(256, 256);
-                pix.fill();
-
-                d->tiles.insert(pos, pix);
+                d->tiles.insert(pos, d->placeholder);
                 emit tileRequest(pos);
+                emit overlayRequest(pos);
             }
         }
     }
@@ -342,16 +1085,49 @@ void MapObject::updateTiles()
     update();
 }
 
+// the shown overlay tiles stay until their new versions arrive
+void MapObject::updateOverlay()
+{
+    for (auto it = d->tiles.cbegin(); it != d->tiles.cend(); ++it)
+        emit overlayRequest(it.key());
+}
+
 QRectF MapObject::boundingRect() const
 {
     return QRectF(d->boundingRect);
 }
 
+void MapObject::setTiming(bool state)
+{
+    d->isTiming = state;
+    d->paintTime = 0;
+}
+
+qint64 MapObject::takePaintTime()
+{
+    const qint64 time = d->paintTime;
+    d->paintTime = 0;
+    return time;
+}
+
+void MapObject::tilesCount(int &drawn, int &placeholders) const
+{
+    placeholders = 0;
+
+    for (auto it = d->tiles.cbegin(); it != d->tiles.cend(); ++it)
+        if (it.value().cacheKey() == d->placeholder.cacheKey()) ++placeholders;
+
+    drawn = d->tiles.size() - placeholders;
+}
+
 void MapObject::paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget)
 {
     Q_UNUSED(item);
     Q_UNUSED(widget);
 
+    QElapsedTimer timer;
+    if (d->isTiming) timer.start();
+
     painter->setPen(QPen(Qt::NoPen));
 
     QMapIterator<QPoint, QPixmap> it(d->tiles);
@@ -365,5 +1141,12 @@ void MapObject::paint(QPainter *painter, const QStyleOptionGraphicsItem *item, Q
         const QPixmap pix = d->tiles.value(it.key());
         painter->drawPixmap(rect, pix, pix.rect());
         painter->drawRect(rect);
+
+        auto overlay = d->overlayTiles.constFind(it.key());
+        if (overlay != d->overlayTiles.cend())
+            painter->drawPixmap(rect, overlay.value(), overlay.value().rect());
     }
+
+    if (d->isTiming)
+        d->paintTime += timer.nsecsElapsed();
 }
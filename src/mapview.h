@@ -1,11 +1,43 @@
 #pragma once
 
+#include "mapclusterlayer.h"
+#include "mapheatmaplayer.h"
+#include "mapmarkerlayer.h"
+#include "maplabellayer.h"
+#include "maptraillayer.h"
+#include "mapoverlay.h"
+#include "maploader.h"
 #include "mapitem.h"
 #include "mapglobal.h"
 
 #include <QGraphicsObject>
 #include <QGraphicsView>
 
+//! \brief The MapUpdateStats struct, counters of queued position updates
+struct MapUpdateStats
+{
+    quint64 received = 0;
+    quint64 merged = 0;  // replaced by a later update of the same item in one frame
+    quint64 dropped = 0; // for items removed from the map
+    quint64 applied = 0;
+    quint64 frames = 0;
+};
+
+//! \brief The MapFrameStats struct, timings and counters of painted frames
+struct MapFrameStats
+{
+    quint64 frames = 0;
+    qreal paintMsec = 0.; // the last frame, whole viewport
+    qreal mapMsec = 0.;   // the last frame, MapObject::paint, 0 when drawn from its cache
+    qreal itemsMsec = 0.; // the last frame, items, layers and the background
+    qreal averagePaintMsec = 0.;
+    qreal maxPaintMsec = 0.;
+    int tilesDrawn = 0;
+    int placeholders = 0; // tiles still loading
+    int visibleItems = 0; // in the viewport
+    int pendingTiles = 0; // requests in flight
+};
+
 class MapView : public QGraphicsView
 {
     Q_OBJECT
@@ -33,6 +65,61 @@ public:
     void removeItem(MapItem *item);
     void clearMap();
 
+    // init(item, index) styles each item before it is indexed and added to the scene
+    QVector<MapItem*> createItems(int count, const std::function<void(MapItem*, int)> &init = Q_NULLPTR);
+    void removeItems(const QVector<MapItem*> &items);
+
+    // live positions are queued, projected in bulk and applied once per frame,
+    // headings are optional, NaN keeps the current one
+    void updatePositions(const QVector<MapItem*> &items, const QVector<QPointF> &coords,
+                         const QVector<qreal> &headings = QVector<qreal>());
+    void setUpdateInterval(int msec);
+    int updateInterval() const;
+    MapUpdateStats updateStats() const;
+    void resetUpdateStats();
+
+    MapLoaderStats loaderStats() const;
+    void resetLoaderStats();
+
+    // frames are timed only while enabled, the overlay shows the stats over the map
+    void setFrameStats(bool state);
+    bool isFrameStats() const;
+    MapFrameStats frameStats() const;
+    void resetFrameStats();
+    void setStatsOverlay(bool state);
+    bool isStatsOverlay() const;
+
+    // items are found through a spatial index, those outside of the view are hidden
+    QVector<MapItem*> findItems(const QPointF &boundLeftTop, const QPointF &boundRightBottom);
+    MapItem *findItemAt(const QPointF &coords);
+
+    // markers stored in arrays, for large sets of moving points
+    MapMarkerLayer *createMarkerLayer();
+    void removeMarkerLayer(MapMarkerLayer *layer);
+
+    // density of weighted points, computed per map tile
+    MapHeatmapLayer *createHeatmapLayer();
+    void removeHeatmapLayer(MapHeatmapLayer *layer);
+
+    // recent tracks of moving objects in ring buffers
+    MapTrailLayer *createTrailLayer();
+    void removeTrailLayer(MapTrailLayer *layer);
+
+    // groups dynamic items, style it through clusterLayer()
+    void setClustering(bool state);
+    bool isClustering() const;
+    MapClusterLayer *clusterLayer() const;
+
+    // item texts are drawn by labelLayer() without overlaps
+    void setLabeling(bool state);
+    bool isLabeling() const;
+    MapLabelLayer *labelLayer() const;
+
+    // static items are drawn into overlay tiles on worker threads
+    void setRasterizing(bool state);
+    bool isRasterizing() const;
+    MapOverlay *overlay() const;
+
 signals:
     void zoomChanged(int zoom);
     void scaleFactorChanged(qreal factor);
@@ -46,12 +133,20 @@ private:
     void resizeEvent(QResizeEvent *e);
     void wheelEvent(QWheelEvent *e);
     void drawBackground(QPainter *painter, const QRectF &r);
+    void drawForeground(QPainter *painter, const QRectF &r);
+    void paintEvent(QPaintEvent *e);
 
     void mousePressEvent(QMouseEvent *e);
     void mouseMoveEvent(QMouseEvent *e);
     void mouseReleaseEvent(QMouseEvent *e);
+    bool isSceneEvent(QMouseEvent *e);
 
     void calculateMapGeometry();
+    void updateItemsCoords();
+    void deleteItems(QVector<QPair<quint64, MapItem*>> items); // (insertion serial, item)
+    void dropPositions(MapItem *item);
+    void applyPositions();
+    void onProjectionFinished();
 
     struct MapViewPrivate;
     MapViewPrivate * const d;
@@ -67,15 +162,23 @@ public:
     explicit MapObject(QGraphicsItem *parent = Q_NULLPTR);
     ~MapObject();
 
+    // paint time is measured only while timing is on
+    void setTiming(bool state);
+    qint64 takePaintTime(); // nanoseconds painted since the last call
+    void tilesCount(int &drawn, int &placeholders) const;
+
 public slots:
     void setTile(const QPoint &pos, const QPixmap &pix);
+    void setOverlayTile(const QPoint &pos, const QPixmap &pix);
     void setTileWidth(qreal tileWidth);
     void setGeometry(const QRect &rect);
     void setBoundingRect(const QRectF &rect);
     void updateTiles();
+    void updateOverlay();
 
 signals:
     void tileRequest(const QPoint &pos);
+    void overlayRequest(const QPoint &pos);
 
 private:
 
@@ -153,8 +153,7 @@ int main(int argc, char *argv[])
     itemLine->setText(lineText, {0, -1000});
 
     // Add provider GoogleMapJapan
-    w.addProvider("GoogleMapJapan", {"http://mt0.google.com/vt/lyrs=m&hl=ja&x=%1&y=%2&z=%3", "/map_ja", Spherical,
-                                     [](int x, int y, int z, QString &url) {url = url.arg(x).arg(y).arg(z);}});
+    w.addProvider("GoogleMapJapan", {"http://mt0.google.com/vt/lyrs=m&hl=ja&x={x}&y={y}&z={z}", "/map_ja", Spherical});
 
     // Change map provider
     QComboBox comboBoxProviders(&w);